@@ -0,0 +1,138 @@
+/* Full-screen upload benchmark: plain memcpy / store loop (the old path)
+ * against the non-temporal stream_copy / stream_fill32 path, writing rows
+ * into a dumb buffer exactly like a repaint does.
+ * The destination is a real write-combined dumb buffer mapping when a DRM
+ * device can be opened (run from a VT, or pass the device path), otherwise
+ * ordinary cacheable memory, which flatters the plain path.
+ *
+ *   build/stream_bench [/dev/dri/cardN] [width height] [iterations]
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include <xf86drm.h>
+
+#include "stream.h"
+
+struct target {
+    int fd;
+    uint32_t handle;
+    uint8_t *map;
+    uint32_t pitch;
+    size_t size;
+};
+
+static int open_dumb(struct target *t, const char *dev, uint32_t w, uint32_t h) {
+    t->fd = open(dev, O_RDWR | O_CLOEXEC);
+    if (t->fd < 0) return -1;
+
+    struct drm_mode_create_dumb creq = {.width = w, .height = h, .bpp = 32};
+    if (drmIoctl(t->fd, DRM_IOCTL_MODE_CREATE_DUMB, &creq) != 0) goto fail;
+    t->handle = creq.handle;
+    t->pitch = creq.pitch;
+    t->size = creq.size;
+
+    struct drm_mode_map_dumb mreq = {.handle = creq.handle};
+    if (drmIoctl(t->fd, DRM_IOCTL_MODE_MAP_DUMB, &mreq) != 0) goto fail;
+    t->map = mmap(NULL, t->size, PROT_READ | PROT_WRITE, MAP_SHARED, t->fd, mreq.offset);
+    if (t->map == MAP_FAILED) goto fail;
+    return 0;
+
+fail:
+    close(t->fd);
+    t->fd = -1;
+    return -1;
+}
+
+static void close_target(struct target *t) {
+    if (t->fd < 0) {
+        free(t->map);
+        return;
+    }
+    munmap(t->map, t->size);
+    struct drm_mode_destroy_dumb dreq = {.handle = t->handle};
+    drmIoctl(t->fd, DRM_IOCTL_MODE_DESTROY_DUMB, &dreq);
+    close(t->fd);
+}
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void copy_plain(const struct target *t, const uint32_t *src, uint32_t w, uint32_t h) {
+    for (uint32_t y = 0; y < h; ++y)
+        memcpy(t->map + (size_t)y * t->pitch, src + (size_t)y * w, (size_t)w * 4);
+}
+
+static void copy_stream(const struct target *t, const uint32_t *src, uint32_t w, uint32_t h) {
+    for (uint32_t y = 0; y < h; ++y)
+        stream_copy(t->map + (size_t)y * t->pitch, src + (size_t)y * w, (size_t)w * 4);
+    stream_fence();
+}
+
+static void fill_plain(const struct target *t, const uint32_t *src, uint32_t w, uint32_t h) {
+    uint32_t color = src[0];
+    for (uint32_t y = 0; y < h; ++y) {
+        uint32_t *row = (uint32_t *)(t->map + (size_t)y * t->pitch);
+        for (uint32_t x = 0; x < w; ++x) row[x] = color;
+    }
+}
+
+static void fill_stream(const struct target *t, const uint32_t *src, uint32_t w, uint32_t h) {
+    for (uint32_t y = 0; y < h; ++y)
+        stream_fill32((uint32_t *)(t->map + (size_t)y * t->pitch), src[0], w);
+    stream_fence();
+}
+
+static void run(const char *name, void (*fn)(const struct target *, const uint32_t *, uint32_t, uint32_t),
+                const struct target *t, const uint32_t *src, uint32_t w, uint32_t h, int iters) {
+    fn(t, src, w, h); /* warm up */
+    double t0 = now_s();
+    for (int i = 0; i < iters; ++i) fn(t, src, w, h);
+    double dt = (now_s() - t0) / iters;
+    printf("%-14s %8.3f ms/frame %8.2f GB/s\n", name, dt * 1e3, (double)w * h * 4 / dt / 1e9);
+}
+
+int main(int argc, char **argv) {
+    const char *dev = argc > 1 ? argv[1] : "/dev/dri/card1";
+    uint32_t w = argc > 3 ? (uint32_t)atoi(argv[2]) : 1920;
+    uint32_t h = argc > 3 ? (uint32_t)atoi(argv[3]) : 1080;
+    int iters = argc > 4 ? atoi(argv[4]) : 200;
+
+    stream_init();
+
+    struct target t = {.fd = -1};
+    if (open_dumb(&t, dev, w, h) == 0) {
+        printf("destination: dumb buffer on %s (pitch %u)\n", dev, t.pitch);
+    } else {
+        printf("destination: malloc (no dumb buffer on %s)\n", dev);
+        t.pitch = w * 4;
+        t.size = (size_t)t.pitch * h;
+        t.map = aligned_alloc(64, t.size);
+        if (!t.map) return 1;
+    }
+
+    uint32_t *src = malloc((size_t)w * h * 4);
+    if (!src) return 1;
+    for (size_t i = 0; i < (size_t)w * h; ++i) src[i] = 0xff000000u | (uint32_t)(i * 2654435761u >> 8);
+
+    printf("%ux%u, %d iterations\n", w, h, iters);
+    run("memcpy", copy_plain, &t, src, w, h, iters);
+    run("stream_copy", copy_stream, &t, src, w, h, iters);
+    run("fill loop", fill_plain, &t, src, w, h, iters);
+    run("stream_fill32", fill_stream, &t, src, w, h, iters);
+
+    free(src);
+    close_target(&t);
+    return 0;
+}
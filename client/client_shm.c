@@ -1,5 +1,9 @@
 // Minimal wl_shm client: creates a surface, a wl_shm_pool -> wl_buffer,
 // draws a simple gradient into XRGB8888 shm and commits the surface.
+// The gradient is animated for 10 seconds, redrawn once per wl_surface.frame
+// callback so the client renders exactly at the compositor's refresh rate.
+// Two buffers from one pool are ping-ponged, reusing each once the compositor
+// sends wl_buffer.release.
 
 #define _GNU_SOURCE
 #include <stdio.h>
@@ -22,6 +26,19 @@ static struct wl_registry *registry = NULL;
 static struct wl_compositor *compositor = NULL;
 static struct wl_shm *shm = NULL;
 
+struct client_buffer {
+    struct wl_buffer *buffer;
+    uint32_t *pixels;
+    int busy; /* attached and not yet released by the compositor */
+};
+
+static struct wl_surface *surface = NULL;
+static struct client_buffer buffers[2];
+static int width = 400;
+static int height = 300;
+static uint32_t first_frame_ms = 0;
+static int running = 1;
+
 static void registry_handler(void *data, struct wl_registry *reg,
                              uint32_t id, const char *interface, uint32_t version) {
     (void)data;
@@ -81,6 +98,69 @@ static int os_create_anonymous_file(off_t size) {
     return fd2;
 }
 
+// draw simple pattern: XRGB8888 (ignore alpha); phase animates the blue channel
+static void draw(uint32_t *pixels, uint8_t phase) {
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            uint8_t r = (uint8_t)((x * 255) / (width - 1));
+            uint8_t g = (uint8_t)((y * 255) / (height - 1));
+            uint8_t b = phase;
+            pixels[y * width + x] = (0xff << 24) | (r << 16) | (g << 8) | b;
+        }
+    }
+}
+
+static void buffer_release(void *data, struct wl_buffer *wl_buffer) {
+    (void)wl_buffer;
+    struct client_buffer *buf = data;
+    buf->busy = 0;
+}
+
+static const struct wl_buffer_listener buffer_listener = {
+    .release = buffer_release
+};
+
+static struct client_buffer *next_buffer(void) {
+    for (int i = 0; i < 2; ++i) {
+        if (!buffers[i].busy) return &buffers[i];
+    }
+    return NULL;
+}
+
+static const struct wl_callback_listener frame_listener;
+
+// draw into a free buffer, queue the next frame callback and commit
+static void commit_frame(uint8_t phase) {
+    struct client_buffer *buf = next_buffer();
+    struct wl_callback *cb = wl_surface_frame(surface);
+    wl_callback_add_listener(cb, &frame_listener, NULL);
+    if (buf) {
+        draw(buf->pixels, phase);
+        wl_surface_attach(surface, buf->buffer, 0, 0);
+        wl_surface_damage(surface, 0, 0, width, height);
+        buf->busy = 1;
+    }
+    wl_surface_commit(surface);
+}
+
+// previous frame is on screen: draw and commit the next one
+static void frame_done(void *data, struct wl_callback *cb, uint32_t time_ms) {
+    (void)data;
+    wl_callback_destroy(cb);
+
+    if (!first_frame_ms) first_frame_ms = time_ms;
+    if (time_ms - first_frame_ms >= 10000) {
+        running = 0;
+        return;
+    }
+
+    commit_frame((uint8_t)(time_ms / 8));
+}
+
+static const struct wl_callback_listener frame_listener = {
+    .done = frame_done
+};
+
 int main(int argc, char **argv) {
 main:
     (void)argc; (void)argv;
@@ -99,10 +179,9 @@ main:
         return 1;
     }
 
-    const int width = 400;
-    const int height = 300;
     const int stride = width * 4;
-    const int size = stride * height;
+    const int buffer_size = stride * height;
+    const int size = buffer_size * 2;
 
     int fd = os_create_anonymous_file(size);
     if (fd < 0) {
@@ -117,38 +196,25 @@ main:
         return 1;
     }
 
-    // draw simple pattern: XRGB8888 (ignore alpha)
-    uint32_t *pix = data;
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            uint8_t r = (uint8_t)((x * 255) / (width - 1));
-            uint8_t g = (uint8_t)((y * 255) / (height - 1));
-            uint8_t b = 0x80;
-            pix[y * width + x] = (0xff << 24) | (r << 16) | (g << 8) | b;
-        }
-    }
-
     struct wl_shm_pool *pool = wl_shm_create_pool(shm, fd, size);
-    struct wl_buffer *buffer = wl_shm_pool_create_buffer(pool, 0, width, height, stride, WL_SHM_FORMAT_XRGB8888);
+    for (int i = 0; i < 2; ++i) {
+        buffers[i].pixels = (uint32_t *)((uint8_t *)data + i * buffer_size);
+        buffers[i].buffer = wl_shm_pool_create_buffer(pool, i * buffer_size, width, height, stride,
+                                                      WL_SHM_FORMAT_XRGB8888);
+        wl_buffer_add_listener(buffers[i].buffer, &buffer_listener, &buffers[i]);
+    }
     wl_shm_pool_destroy(pool);
     close(fd);
 
-    struct wl_surface *surface = wl_compositor_create_surface(compositor);
-    wl_surface_attach(surface, buffer, 0, 0);
-    wl_surface_commit(surface);
+    surface = wl_compositor_create_surface(compositor);
+    commit_frame(0x80);
 
-    // roundtrips to ensure commit processed
-    wl_display_roundtrip(display);
-
-    // keep window visible for 10 seconds, dispatching events
-    for (int i = 0; i < 100; ++i) {
-        wl_display_dispatch_pending(display);
-        wl_display_flush(display);
-        usleep(100000); // 100 ms
-    }
+    // keep window visible for 10 seconds; frame callbacks drive redraws
+    while (running && wl_display_dispatch(display) != -1)
+        ;
 
     // cleanup
-    wl_buffer_destroy(buffer);
+    for (int i = 0; i < 2; ++i) wl_buffer_destroy(buffers[i].buffer);
     wl_surface_destroy(surface);
     munmap(data, size);
     wl_display_roundtrip(display);
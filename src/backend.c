@@ -0,0 +1,45 @@
+#include "backend.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+const struct backend *backend;
+
+static const struct backend *const backends[] = {
+    &drm_backend,
+    &headless_backend,
+};
+
+int backend_init(void) {
+    const char *env = getenv("ARGUS_BACKEND");
+    if (env) {
+        for (size_t i = 0; i < sizeof(backends) / sizeof(backends[0]); ++i) {
+            if (strcmp(env, backends[i]->name) != 0) continue;
+            if (backends[i]->setup() != 0) {
+                fprintf(stderr, "backend: %s setup failed\n", env);
+                return -1;
+            }
+            backend = backends[i];
+            printf("backend: %s\n", backend->name);
+            return 0;
+        }
+        fprintf(stderr, "backend: unknown ARGUS_BACKEND=%s\n", env);
+        return -1;
+    }
+
+    for (size_t i = 0; i < sizeof(backends) / sizeof(backends[0]); ++i) {
+        if (backends[i]->setup() == 0) {
+            backend = backends[i];
+            printf("backend: %s\n", backend->name);
+            return 0;
+        }
+        fprintf(stderr, "backend: %s unavailable\n", backends[i]->name);
+    }
+    return -1;
+}
+
+void backend_fini(void) {
+    if (backend) backend->teardown();
+    backend = NULL;
+}
@@ -0,0 +1,149 @@
+#ifndef ARGUS_BACKEND_H
+#define ARGUS_BACKEND_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "region.h"
+
+/* Output backend: where composited frames go and where flip completion
+ * comes from. backend_init() picks one from ARGUS_BACKEND ("drm" or
+ * "headless"); unset, DRM is tried first and the headless backend is used
+ * if it cannot be set up. The chosen backend is reached through `backend`.
+ *
+ * A backend drives up to BACKEND_MAX_OUTPUTS outputs, each with its own
+ * swapchain and refresh rate, named by ids that are never reused. Outputs
+ * come and go (hotplug) while the backend runs; the handler installed with
+ * set_output_handler() hears about each, starting with those present when
+ * it is installed.
+ *
+ * Software-rendered frame: the buffer to draw into and the area that must
+ * be redrawn in it. frame_begin picks a free swapchain slot of an output;
+ * the caller redraws repaint and hands the slot over with frame_submit,
+ * which queues it for the output's next vblank without waiting.
+ * frame_begin returns 1 without starting a frame if every slot is busy,
+ * and -1 if there is no such output.
+ *
+ * Flip completions and hotplug are read by dispatch() when the fd from
+ * get_fd() polls readable; flips are reported to the handler installed
+ * with set_flip_done_handler(), with the vblank counter and
+ * CLOCK_MONOTONIC timestamp of the flip.
+ *
+ * Every frame drawn on an output gets a sequence number: present_seq() is
+ * that of the last frame drawn, scanout_seq() that of the frame on screen.
+ * Frames replaced before they were flipped are skipped, so a frame is done
+ * once the scanout sequence reaches it.
+ *
+ * Once set up, the backend belongs to a single thread (the render thread),
+ * which also runs the handlers; only the cursor and dmabuf functions may
+ * be called from another.
+ */
+#define BACKEND_MAX_OUTPUTS 8
+
+/* Overlay planes a frame may use, and one of them: a framebuffer from
+ * import_dmabuf shown unscaled at (x, y) in the output */
+#define BACKEND_MAX_OVERLAYS 4
+
+struct backend_overlay {
+    uint32_t fb_id;
+    int32_t x, y;
+    uint32_t width, height;
+};
+
+struct backend_frame {
+    void *map;
+    uint32_t pitch;
+    int write_combined; /* map is an uncached mapping */
+    uint32_t width, height;
+    struct region damage;
+    struct region repaint;
+    int slot;
+    /* Shown above the drawn contents, bottom first; set by the caller
+     * before frame_submit */
+    struct backend_overlay overlays[BACKEND_MAX_OVERLAYS];
+    int noverlays;
+};
+
+/* A client dmabuf (zwp_linux_dmabuf_v1), one fd per plane */
+#define BACKEND_DMABUF_MAX_PLANES 4
+
+struct backend_dmabuf {
+    int32_t width, height;
+    uint32_t format; /* DRM_FORMAT_* */
+    uint64_t modifier; /* DRM_FORMAT_MOD_INVALID for an implicit one */
+    int nplanes;
+    int fd[BACKEND_DMABUF_MAX_PLANES];
+    uint32_t offset[BACKEND_DMABUF_MAX_PLANES];
+    uint32_t stride[BACKEND_DMABUF_MAX_PLANES];
+};
+
+struct backend_output_info {
+    uint32_t id;
+    uint32_t width, height;
+    uint32_t refresh_mhz;
+    char name[32];
+};
+
+typedef void (*backend_flip_done_fn)(uint32_t output, unsigned int frame, unsigned int sec, unsigned int usec,
+                                     void *data);
+/* added is 0 when the output has gone away */
+typedef void (*backend_output_fn)(int added, const struct backend_output_info *info, void *data);
+
+struct backend {
+    const char *name;
+    int (*setup)(void);
+    void (*teardown)(void);
+
+    int (*frame_begin)(uint32_t output, struct backend_frame *f, const struct region *damage);
+    int (*frame_submit)(uint32_t output, struct backend_frame *f);
+    /* Direct scanout: queue a framebuffer from import_dmabuf, exactly the
+     * output's size, as the output's next frame in place of a drawn one.
+     * Returns -1 if the output cannot show it, in which case nothing was
+     * queued. The framebuffer must stay until a later frame of the output
+     * is on screen. */
+    int (*frame_scanout)(uint32_t output, uint32_t fb_id);
+    /* 0 if the output could show these overlays (bottom first) over its
+     * next drawn frame, -1 if not; nothing is shown. Overlay framebuffers
+     * must stay like direct ones. */
+    int (*overlay_test)(uint32_t output, const struct backend_overlay *overlays, int n);
+
+    int (*get_fd)(void);
+    int (*dispatch)(void);
+    /* 1 if frame_begin would find a free slot, 0 if not, -1 if there is
+     * no such output */
+    int (*can_present)(uint32_t output);
+    uint64_t (*present_seq)(uint32_t output);
+    uint64_t (*scanout_seq)(uint32_t output);
+    /* Refresh period in ns, measured from flips where the backend can */
+    uint64_t (*refresh_ns)(uint32_t output);
+    void (*set_flip_done_handler)(backend_flip_done_fn fn, void *data);
+    void (*set_output_handler)(backend_output_fn fn, void *data);
+
+    /* Cursor planes, updated independently of the swapchains so pointer
+     * motion never causes a repaint. cursor_set_image copies an ARGB8888
+     * image and shows it on every output with the given hotspot (argb ==
+     * NULL hides it); cursor_move places the hotspot at (x, y) in the
+     * output's pixels, which may be off that output. Both return -1 if
+     * there is no usable cursor plane. */
+    int (*cursor_set_image)(const void *argb, uint32_t stride, uint32_t width, uint32_t height,
+                            int32_t hot_x, int32_t hot_y);
+    int (*cursor_move)(uint32_t output, int32_t x, int32_t y);
+
+    /* Client dmabufs. device() is the dev_t clients should allocate for
+     * (0 if the backend has none). import_dmabuf turns a dmabuf into a
+     * framebuffer the backend could scan out, returning -1 if it cannot;
+     * the fds stay the caller's. release_dmabuf drops that framebuffer. */
+    dev_t (*device)(void);
+    int (*import_dmabuf)(const struct backend_dmabuf *buf, uint32_t *fb_id);
+    void (*release_dmabuf)(uint32_t fb_id);
+};
+
+extern const struct backend drm_backend;
+extern const struct backend headless_backend;
+
+extern const struct backend *backend;
+
+int backend_init(void);
+void backend_fini(void);
+
+#endif
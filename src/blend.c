@@ -0,0 +1,251 @@
+#include "blend.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BLEND_X86 1
+#endif
+
+#define SELFTEST_PIXELS 1031 /* odd, so every kernel also runs its tail */
+
+/* x / 255 rounded to nearest, exact for x <= 255 * 255 */
+static inline uint32_t div255(uint32_t x) {
+    x += 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+static inline uint32_t over_pixel(uint32_t d, uint32_t s) {
+    uint32_t ia = 255 - (s >> 24);
+    uint32_t out = 0;
+    for (int shift = 0; shift < 32; shift += 8) {
+        uint32_t c = ((s >> shift) & 0xff) + div255(((d >> shift) & 0xff) * ia);
+        out |= (c > 255 ? 255 : c) << shift;
+    }
+    return out;
+}
+
+static void blend_over_scalar(uint32_t *dst, const uint32_t *src, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        uint32_t s = src[i];
+        if (s == 0) continue;
+        if ((s >> 24) == 0xff) dst[i] = s;
+        else dst[i] = over_pixel(dst[i], s);
+    }
+}
+
+#ifdef BLEND_X86
+
+/* The vector kernels widen each byte to 16 bits and compute
+ * t = d * (255 - a) + 128, (t + (t >> 8)) >> 8 in every lane, which is
+ * div255() above; t stays below 65536. */
+
+__attribute__((target("sse2")))
+static inline __m128i over_sse2(__m128i d, __m128i s) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i c255 = _mm_set1_epi16(0xff);
+    const __m128i c128 = _mm_set1_epi16(0x80);
+
+    __m128i s_lo = _mm_unpacklo_epi8(s, zero), s_hi = _mm_unpackhi_epi8(s, zero);
+    __m128i d_lo = _mm_unpacklo_epi8(d, zero), d_hi = _mm_unpackhi_epi8(d, zero);
+
+    /* broadcast each pixel's alpha (lane 3 of 4) and invert it */
+    __m128i a_lo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s_lo, 0xff), 0xff);
+    __m128i a_hi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s_hi, 0xff), 0xff);
+    a_lo = _mm_xor_si128(a_lo, c255);
+    a_hi = _mm_xor_si128(a_hi, c255);
+
+    __m128i t_lo = _mm_add_epi16(_mm_mullo_epi16(d_lo, a_lo), c128);
+    __m128i t_hi = _mm_add_epi16(_mm_mullo_epi16(d_hi, a_hi), c128);
+    t_lo = _mm_srli_epi16(_mm_add_epi16(t_lo, _mm_srli_epi16(t_lo, 8)), 8);
+    t_hi = _mm_srli_epi16(_mm_add_epi16(t_hi, _mm_srli_epi16(t_hi, 8)), 8);
+
+    return _mm_adds_epu8(_mm_packus_epi16(t_lo, t_hi), s);
+}
+
+__attribute__((target("sse2")))
+static void blend_over_sse2(uint32_t *dst, const uint32_t *src, size_t n) {
+    const __m128i amask = _mm_set1_epi32((int)0xff000000u);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i a = _mm_and_si128(s, amask);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(s, _mm_setzero_si128())) == 0xffff) continue;
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(a, amask)) == 0xffff) {
+            _mm_storeu_si128((__m128i *)(dst + i), s);
+            continue;
+        }
+        __m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+        _mm_storeu_si128((__m128i *)(dst + i), over_sse2(d, s));
+    }
+    blend_over_scalar(dst + i, src + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i over_avx2(__m256i d, __m256i s) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i c255 = _mm256_set1_epi16(0xff);
+    const __m256i c128 = _mm256_set1_epi16(0x80);
+
+    /* unpack and pack both work within 128-bit lanes, so pixel order
+     * survives the round trip */
+    __m256i s_lo = _mm256_unpacklo_epi8(s, zero), s_hi = _mm256_unpackhi_epi8(s, zero);
+    __m256i d_lo = _mm256_unpacklo_epi8(d, zero), d_hi = _mm256_unpackhi_epi8(d, zero);
+
+    __m256i a_lo = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(s_lo, 0xff), 0xff);
+    __m256i a_hi = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(s_hi, 0xff), 0xff);
+    a_lo = _mm256_xor_si256(a_lo, c255);
+    a_hi = _mm256_xor_si256(a_hi, c255);
+
+    __m256i t_lo = _mm256_add_epi16(_mm256_mullo_epi16(d_lo, a_lo), c128);
+    __m256i t_hi = _mm256_add_epi16(_mm256_mullo_epi16(d_hi, a_hi), c128);
+    t_lo = _mm256_srli_epi16(_mm256_add_epi16(t_lo, _mm256_srli_epi16(t_lo, 8)), 8);
+    t_hi = _mm256_srli_epi16(_mm256_add_epi16(t_hi, _mm256_srli_epi16(t_hi, 8)), 8);
+
+    return _mm256_adds_epu8(_mm256_packus_epi16(t_lo, t_hi), s);
+}
+
+__attribute__((target("avx2")))
+static void blend_over_avx2(uint32_t *dst, const uint32_t *src, size_t n) {
+    const __m256i amask = _mm256_set1_epi32((int)0xff000000u);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i s = _mm256_loadu_si256((const __m256i *)(src + i));
+        if (_mm256_testz_si256(s, s)) continue;
+        __m256i a = _mm256_and_si256(s, amask);
+        if ((uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi32(a, amask)) == 0xffffffffu) {
+            _mm256_storeu_si256((__m256i *)(dst + i), s);
+            continue;
+        }
+        __m256i d = _mm256_loadu_si256((const __m256i *)(dst + i));
+        _mm256_storeu_si256((__m256i *)(dst + i), over_avx2(d, s));
+    }
+    blend_over_sse2(dst + i, src + i, n - i);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void blend_over_avx512(uint32_t *dst, const uint32_t *src, size_t n) {
+    const __m512i zero = _mm512_setzero_si512();
+    const __m512i c255 = _mm512_set1_epi16(0xff);
+    const __m512i c128 = _mm512_set1_epi16(0x80);
+    const __m512i amask = _mm512_set1_epi32((int)0xff000000u);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512i s = _mm512_loadu_si512(src + i);
+        if (_mm512_test_epi32_mask(s, s) == 0) continue;
+        if (_mm512_cmpeq_epi32_mask(_mm512_and_si512(s, amask), amask) == 0xffff) {
+            _mm512_storeu_si512(dst + i, s);
+            continue;
+        }
+        __m512i d = _mm512_loadu_si512(dst + i);
+
+        __m512i s_lo = _mm512_unpacklo_epi8(s, zero), s_hi = _mm512_unpackhi_epi8(s, zero);
+        __m512i d_lo = _mm512_unpacklo_epi8(d, zero), d_hi = _mm512_unpackhi_epi8(d, zero);
+
+        __m512i a_lo = _mm512_shufflehi_epi16(_mm512_shufflelo_epi16(s_lo, 0xff), 0xff);
+        __m512i a_hi = _mm512_shufflehi_epi16(_mm512_shufflelo_epi16(s_hi, 0xff), 0xff);
+        a_lo = _mm512_xor_si512(a_lo, c255);
+        a_hi = _mm512_xor_si512(a_hi, c255);
+
+        __m512i t_lo = _mm512_add_epi16(_mm512_mullo_epi16(d_lo, a_lo), c128);
+        __m512i t_hi = _mm512_add_epi16(_mm512_mullo_epi16(d_hi, a_hi), c128);
+        t_lo = _mm512_srli_epi16(_mm512_add_epi16(t_lo, _mm512_srli_epi16(t_lo, 8)), 8);
+        t_hi = _mm512_srli_epi16(_mm512_add_epi16(t_hi, _mm512_srli_epi16(t_hi, 8)), 8);
+
+        _mm512_storeu_si512(dst + i, _mm512_adds_epu8(_mm512_packus_epi16(t_lo, t_hi), s));
+    }
+    blend_over_avx2(dst + i, src + i, n - i);
+}
+
+#endif /* BLEND_X86 */
+
+struct blend_kernel {
+    const char *name;
+    blend_span_fn fn;
+    int (*supported)(void);
+};
+
+static int cpu_any(void) {
+    return 1;
+}
+
+#ifdef BLEND_X86
+static int cpu_sse2(void) {
+    return __builtin_cpu_supports("sse2");
+}
+static int cpu_avx2(void) {
+    return __builtin_cpu_supports("avx2");
+}
+static int cpu_avx512(void) {
+    return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+}
+#endif
+
+/* widest first */
+static const struct blend_kernel kernels[] = {
+#ifdef BLEND_X86
+    {"avx512", blend_over_avx512, cpu_avx512},
+    {"avx2", blend_over_avx2, cpu_avx2},
+    {"sse2", blend_over_sse2, cpu_sse2},
+#endif
+    {"scalar", blend_over_scalar, cpu_any},
+};
+
+#define NKERNELS (sizeof(kernels) / sizeof(kernels[0]))
+
+blend_span_fn blend_over_span = blend_over_scalar;
+static const char *kernel_name = "scalar";
+
+/* Run fn and the scalar kernel over the same pseudo-random spans (covering
+ * the transparent, opaque and unaligned-tail cases) and compare */
+static int kernel_matches_scalar(blend_span_fn fn) {
+    static uint32_t src[SELFTEST_PIXELS], ref[SELFTEST_PIXELS], out[SELFTEST_PIXELS];
+    uint32_t x = 0x12345678u;
+    for (int i = 0; i < SELFTEST_PIXELS; ++i) {
+        x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+        uint32_t a = (x >> 24) & 0xff;
+        /* premultiplied source, with runs of fully clear and opaque pixels */
+        if ((i / 16) % 4 == 1) a = 0;
+        else if ((i / 16) % 4 == 2) a = 0xff;
+        uint32_t r = ((x >> 16) & 0xff) * a / 255, g = ((x >> 8) & 0xff) * a / 255, b = (x & 0xff) * a / 255;
+        src[i] = (a << 24) | (r << 16) | (g << 8) | b;
+        x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+        ref[i] = out[i] = x;
+    }
+    blend_over_scalar(ref, src, SELFTEST_PIXELS);
+    /* start one pixel in so the vector loops also see unaligned data */
+    fn(out, src, 1);
+    fn(out + 1, src + 1, SELFTEST_PIXELS - 1);
+    return memcmp(ref, out, sizeof(ref)) == 0;
+}
+
+void blend_init(void) {
+    const char *want = getenv("ARGUS_BLEND");
+#ifdef BLEND_X86
+    __builtin_cpu_init();
+#endif
+
+    for (size_t i = 0; i < NKERNELS; ++i) {
+        const struct blend_kernel *k = &kernels[i];
+        if (want && strcmp(want, k->name) != 0) continue;
+        if (!k->supported()) continue;
+        if (!kernel_matches_scalar(k->fn)) {
+            fprintf(stderr, "blend: %s kernel disagrees with scalar, not using it\n", k->name);
+            continue;
+        }
+        blend_over_span = k->fn;
+        kernel_name = k->name;
+        printf("blend: using %s kernel\n", kernel_name);
+        return;
+    }
+
+    if (want) fprintf(stderr, "blend: kernel '%s' unavailable, using scalar\n", want);
+    blend_over_span = blend_over_scalar;
+    kernel_name = "scalar";
+}
+
+const char *blend_kernel_name(void) {
+    return kernel_name;
+}
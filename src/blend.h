@@ -0,0 +1,22 @@
+#ifndef ARGUS_BLEND_H
+#define ARGUS_BLEND_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Premultiplied ARGB8888 "over": dst = src + dst * (255 - src.a) / 255 per
+ * channel, rounded to nearest and saturated. Every kernel produces exactly
+ * the scalar result.
+ *
+ * blend_init() picks the widest kernel the CPU supports (AVX-512BW, AVX2,
+ * SSE2, scalar), unless ARGUS_BLEND names one, and verifies it against the
+ * scalar kernel before use; a kernel that disagrees is not used.
+ */
+typedef void (*blend_span_fn)(uint32_t *dst, const uint32_t *src, size_t n);
+
+void blend_init(void);
+const char *blend_kernel_name(void);
+
+extern blend_span_fn blend_over_span;
+
+#endif
@@ -0,0 +1,235 @@
+#include "convert.h"
+
+#include <wayland-server-protocol.h>
+#include <drm/drm_fourcc.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CONVERT_X86 1
+#endif
+
+#define SELFTEST_PIXELS 1031 /* odd, so the vector loops also run their tail */
+
+/* --- scalar --- */
+
+static void convert_argb8888(uint32_t *dst, const void *src, size_t n) {
+    memcpy(dst, src, n * 4);
+}
+
+static void convert_xrgb8888(uint32_t *dst, const void *src, size_t n) {
+    const uint32_t *s = src;
+    for (size_t i = 0; i < n; ++i) dst[i] = s[i] | 0xff000000u;
+}
+
+static void convert_abgr8888(uint32_t *dst, const void *src, size_t n) {
+    const uint32_t *s = src;
+    for (size_t i = 0; i < n; ++i) {
+        uint32_t p = s[i];
+        dst[i] = (p & 0xff00ff00u) | ((p & 0xff) << 16) | ((p >> 16) & 0xff);
+    }
+}
+
+static void convert_xbgr8888(uint32_t *dst, const void *src, size_t n) {
+    const uint32_t *s = src;
+    for (size_t i = 0; i < n; ++i) {
+        uint32_t p = s[i];
+        dst[i] = 0xff000000u | (p & 0xff00) | ((p & 0xff) << 16) | ((p >> 16) & 0xff);
+    }
+}
+
+/* 5/6-bit channels are widened by replicating their top bits */
+static void convert_rgb565(uint32_t *dst, const void *src, size_t n) {
+    const uint16_t *s = src;
+    for (size_t i = 0; i < n; ++i) {
+        uint32_t p = s[i];
+        uint32_t r = p >> 11, g = (p >> 5) & 0x3f, b = p & 0x1f;
+        r = (r << 3) | (r >> 2);
+        g = (g << 2) | (g >> 4);
+        b = (b << 3) | (b >> 2);
+        dst[i] = 0xff000000u | (r << 16) | (g << 8) | b;
+    }
+}
+
+/* 10-bit channels keep their top 8 bits */
+static void convert_xrgb2101010(uint32_t *dst, const void *src, size_t n) {
+    const uint32_t *s = src;
+    for (size_t i = 0; i < n; ++i) {
+        uint32_t p = s[i];
+        uint32_t r = (p >> 22) & 0xff, g = (p >> 12) & 0xff, b = (p >> 2) & 0xff;
+        dst[i] = 0xff000000u | (r << 16) | (g << 8) | b;
+    }
+}
+
+/* --- AVX2 --- */
+
+#ifdef CONVERT_X86
+
+__attribute__((target("avx2")))
+static void convert_xrgb8888_avx2(uint32_t *dst, const void *src, size_t n) {
+    const uint32_t *s = src;
+    const __m256i alpha = _mm256_set1_epi32((int)0xff000000u);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i p = _mm256_loadu_si256((const __m256i *)(s + i));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_or_si256(p, alpha));
+    }
+    convert_xrgb8888(dst + i, s + i, n - i);
+}
+
+/* swap bytes 0 and 2 of every pixel */
+__attribute__((target("avx2")))
+static inline __m256i swap_rb_avx2(__m256i p) {
+    const __m256i shuf = _mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+                                          2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+    return _mm256_shuffle_epi8(p, shuf);
+}
+
+__attribute__((target("avx2")))
+static void convert_abgr8888_avx2(uint32_t *dst, const void *src, size_t n) {
+    const uint32_t *s = src;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i p = _mm256_loadu_si256((const __m256i *)(s + i));
+        _mm256_storeu_si256((__m256i *)(dst + i), swap_rb_avx2(p));
+    }
+    convert_abgr8888(dst + i, s + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void convert_xbgr8888_avx2(uint32_t *dst, const void *src, size_t n) {
+    const uint32_t *s = src;
+    const __m256i alpha = _mm256_set1_epi32((int)0xff000000u);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i p = _mm256_loadu_si256((const __m256i *)(s + i));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_or_si256(swap_rb_avx2(p), alpha));
+    }
+    convert_xbgr8888(dst + i, s + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void convert_rgb565_avx2(uint32_t *dst, const void *src, size_t n) {
+    const uint16_t *s = src;
+    const __m256i alpha = _mm256_set1_epi32((int)0xff000000u);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i p = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(s + i)));
+        /* each channel lands in place along with its replicated top bits */
+        __m256i r = _mm256_or_si256(_mm256_slli_epi32(_mm256_and_si256(p, _mm256_set1_epi32(0xf800)), 8),
+                                    _mm256_slli_epi32(_mm256_and_si256(p, _mm256_set1_epi32(0xe000)), 3));
+        __m256i g = _mm256_or_si256(_mm256_slli_epi32(_mm256_and_si256(p, _mm256_set1_epi32(0x07e0)), 5),
+                                    _mm256_srli_epi32(_mm256_and_si256(p, _mm256_set1_epi32(0x0600)), 1));
+        __m256i b = _mm256_or_si256(_mm256_slli_epi32(_mm256_and_si256(p, _mm256_set1_epi32(0x001f)), 3),
+                                    _mm256_and_si256(_mm256_srli_epi32(p, 2), _mm256_set1_epi32(0x07)));
+        __m256i out = _mm256_or_si256(_mm256_or_si256(r, g), _mm256_or_si256(b, alpha));
+        _mm256_storeu_si256((__m256i *)(dst + i), out);
+    }
+    convert_rgb565(dst + i, s + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void convert_xrgb2101010_avx2(uint32_t *dst, const void *src, size_t n) {
+    const uint32_t *s = src;
+    const __m256i alpha = _mm256_set1_epi32((int)0xff000000u);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i p = _mm256_loadu_si256((const __m256i *)(s + i));
+        __m256i r = _mm256_and_si256(_mm256_srli_epi32(p, 6), _mm256_set1_epi32(0xff0000));
+        __m256i g = _mm256_and_si256(_mm256_srli_epi32(p, 4), _mm256_set1_epi32(0x00ff00));
+        __m256i b = _mm256_and_si256(_mm256_srli_epi32(p, 2), _mm256_set1_epi32(0x0000ff));
+        __m256i out = _mm256_or_si256(_mm256_or_si256(r, g), _mm256_or_si256(b, alpha));
+        _mm256_storeu_si256((__m256i *)(dst + i), out);
+    }
+    convert_xrgb2101010(dst + i, s + i, n - i);
+}
+
+#endif /* CONVERT_X86 */
+
+/* Advertised in this order; the two mandatory formats first */
+static struct pixel_format formats[] = {
+    {WL_SHM_FORMAT_ARGB8888, DRM_FORMAT_ARGB8888, 4, 0, convert_argb8888},
+    {WL_SHM_FORMAT_XRGB8888, DRM_FORMAT_XRGB8888, 4, 1, convert_xrgb8888},
+    {WL_SHM_FORMAT_ABGR8888, DRM_FORMAT_ABGR8888, 4, 0, convert_abgr8888},
+    {WL_SHM_FORMAT_XBGR8888, DRM_FORMAT_XBGR8888, 4, 1, convert_xbgr8888},
+    {WL_SHM_FORMAT_RGB565, DRM_FORMAT_RGB565, 2, 1, convert_rgb565},
+    {WL_SHM_FORMAT_XRGB2101010, DRM_FORMAT_XRGB2101010, 4, 1, convert_xrgb2101010},
+};
+
+#define NFORMATS (sizeof(formats) / sizeof(formats[0]))
+
+#ifdef CONVERT_X86
+static const struct {
+    uint32_t shm_format;
+    convert_row_fn fn;
+} avx2_converters[] = {
+    {WL_SHM_FORMAT_XRGB8888, convert_xrgb8888_avx2},
+    {WL_SHM_FORMAT_ABGR8888, convert_abgr8888_avx2},
+    {WL_SHM_FORMAT_XBGR8888, convert_xbgr8888_avx2},
+    {WL_SHM_FORMAT_RGB565, convert_rgb565_avx2},
+    {WL_SHM_FORMAT_XRGB2101010, convert_xrgb2101010_avx2},
+};
+
+/* Run fn and the scalar converter over the same pseudo-random row and compare */
+static int converter_matches(convert_row_fn fn, convert_row_fn ref_fn) {
+    static uint32_t src[SELFTEST_PIXELS], ref[SELFTEST_PIXELS], out[SELFTEST_PIXELS];
+    uint32_t x = 0x9e3779b9u;
+    for (int i = 0; i < SELFTEST_PIXELS; ++i) {
+        x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+        src[i] = x;
+    }
+    ref_fn(ref, src, SELFTEST_PIXELS);
+    fn(out, src, SELFTEST_PIXELS);
+    return memcmp(ref, out, sizeof(ref)) == 0;
+}
+#endif
+
+void convert_init(void) {
+#ifdef CONVERT_X86
+    const char *want = getenv("ARGUS_CONVERT");
+    if (want && strcmp(want, "scalar") == 0) return;
+    __builtin_cpu_init();
+    if (!__builtin_cpu_supports("avx2")) return;
+
+    size_t installed = 0, total = sizeof(avx2_converters) / sizeof(avx2_converters[0]);
+    for (size_t i = 0; i < total; ++i) {
+        for (size_t j = 0; j < NFORMATS; ++j) {
+            struct pixel_format *pf = &formats[j];
+            if (pf->shm_format != avx2_converters[i].shm_format) continue;
+            if (converter_matches(avx2_converters[i].fn, pf->convert)) {
+                pf->convert = avx2_converters[i].fn;
+                installed++;
+            } else {
+                fprintf(stderr, "convert: AVX2 converter for format %#x disagrees with scalar\n", pf->shm_format);
+            }
+        }
+    }
+    if (installed == total) printf("convert: using AVX2 converters\n");
+    else printf("convert: using AVX2 converters for %zu of %zu formats, scalar for the rest\n", installed, total);
+#endif
+}
+
+const struct pixel_format *pixel_format_lookup(uint32_t shm_format) {
+    for (size_t i = 0; i < NFORMATS; ++i) {
+        if (formats[i].shm_format == shm_format) return &formats[i];
+    }
+    return NULL;
+}
+
+const struct pixel_format *pixel_format_lookup_drm(uint32_t drm_format) {
+    for (size_t i = 0; i < NFORMATS; ++i) {
+        if (formats[i].drm_format == drm_format) return &formats[i];
+    }
+    return NULL;
+}
+
+size_t pixel_format_count(void) {
+    return NFORMATS;
+}
+
+const struct pixel_format *pixel_format_at(size_t i) {
+    return i < NFORMATS ? &formats[i] : NULL;
+}
@@ -0,0 +1,35 @@
+#ifndef ARGUS_CONVERT_H
+#define ARGUS_CONVERT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Conversion of client pixel formats into the compositor's premultiplied
+ * ARGB8888. Opaque formats come out with alpha 0xff.
+ *
+ * convert_init() selects the AVX2 row converters when the CPU has them
+ * (ARGUS_CONVERT=scalar disables them) after checking them against the
+ * scalar ones; the scalar loops are branch-free so the compiler vectorises
+ * them for the baseline ISA.
+ */
+typedef void (*convert_row_fn)(uint32_t *dst, const void *src, size_t n);
+
+struct pixel_format {
+    uint32_t shm_format; /* WL_SHM_FORMAT_* */
+    uint32_t drm_format; /* DRM_FORMAT_*, for dmabufs */
+    uint32_t bpp; /* bytes per pixel */
+    int opaque;
+    convert_row_fn convert;
+};
+
+void convert_init(void);
+
+/* Supported format, or NULL */
+const struct pixel_format *pixel_format_lookup(uint32_t shm_format);
+const struct pixel_format *pixel_format_lookup_drm(uint32_t drm_format);
+
+/* Every supported format, for wl_shm.format and the dmabuf format table */
+size_t pixel_format_count(void);
+const struct pixel_format *pixel_format_at(size_t i);
+
+#endif
@@ -1,137 +1,258 @@
 #define _GNU_SOURCE
 #include "drm_simple.h"
+#include "stream.h"
+#include "swapchain.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/epoll.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <errno.h>
 #include <stdint.h>
 #include <poll.h>
+#include <pthread.h>
 
 #include <drm/drm.h>
+#include <drm/drm_fourcc.h>
+#include <libudev.h>
 #include <xf86drm.h>
 #include <xf86drmMode.h>
 
-/* Minimal DRM state for double-buffered pageflip testing */
-struct drm_state {
-    int fd;
-    drmModeConnector *conn;
-    drmModeRes *res;
-    drmModeEncoder *enc;
-    drmModeCrtc *crtc;
-    uint32_t crtc_index;
+/* Shadow framebuffer allocation granule (huge page) */
+#define SHADOW_HUGE_PAGE (2u << 20)
+
+/* Buffer of a swapchain slot: a dumb buffer, or for a direct slot only
+ * fb_id, borrowed from a client buffer */
+struct drm_slot {
+    uint32_t fb_id;
+    uint32_t handle;
+    uint32_t pitch;
+    uint64_t size;
+    void *map;
+    /* client framebuffers flipped in with the slot, bottom first */
+    struct backend_overlay overlays[BACKEND_MAX_OVERLAYS];
+    int noverlays;
+};
+
+/* Property ids of a plane, as needed to point it at a framebuffer */
+struct plane_props {
+    uint32_t fb_id;
     uint32_t crtc_id;
+    uint32_t src_x, src_y, src_w, src_h;
+    uint32_t crtc_x, crtc_y, crtc_w, crtc_h;
+};
+
+/* Atomic KMS state of an output; unused (enabled == 0) when it falls back
+ * to legacy */
+struct drm_atomic {
+    int enabled;
+    uint32_t primary_plane;
+    struct plane_props primary;
+    /* overlay planes claimed by the output, lowest zpos first */
+    uint32_t overlay_plane[BACKEND_MAX_OVERLAYS];
+    struct plane_props overlay[BACKEND_MAX_OVERLAYS];
+    int noverlays;
+    uint32_t conn_crtc_id;
+    uint32_t crtc_mode_id;
+    uint32_t crtc_active;
+    uint32_t mode_blob;
+};
+
+/* A connected connector driven by its own CRTC and swapchain */
+struct drm_output {
+    uint32_t id;
+    char name[32];
     uint32_t connector_id;
+    uint32_t crtc_id;
+    uint32_t crtc_index;
     drmModeModeInfo mode;
+    int gone; /* unplugged; freed once its last flip has landed */
+
+    struct swapchain sc;
+    struct drm_slot slots[SWAPCHAIN_ALL_SLOTS]; /* buffers of sc's slots */
+    int pending_flip; /* whether a flip is pending */
+    int mode_set; /* whether the CRTC has been programmed with our mode */
+    struct drm_atomic atomic;
+
+    /* Cacheable copy of the newest frame (unless ARGUS_SHADOW=0). Frames
+     * are drawn here, then only the rectangles a slot is missing are
+     * streamed into its write-combined mapping. */
+    uint8_t *shadow;
+    uint32_t shadow_pitch;
+    size_t shadow_size;
+
+    /* The last frame was scanned out directly, so neither the shadow nor
+     * the swapchain holds it: the next drawn frame is drawn whole */
+    int composite_stale;
+
+    /* Frame number currently on screen */
+    uint64_t scanout_seq;
 
-    /* Two dumb buffers for pageflipping */
-    uint32_t fb_id[2];
+    /* Last flip (CLOCK_MONOTONIC ns, kernel vblank counter) and the
+     * refresh period measured from successive flips */
+    uint64_t last_flip_ns;
+    unsigned int last_flip_frame;
+    uint64_t refresh_ns;
+
+    /* Cursor hotspot in output pixels, and whether the cursor changed
+     * before the CRTC was lit */
+    int32_t cursor_x, cursor_y;
+    int cursor_dirty;
+};
+
+/* Hardware cursor image: two dumb buffers alternated on image updates so
+ * the one being scanned out is never rewritten. Every output shows the
+ * same buffer on its own cursor plane. */
+struct drm_cursor {
+    int enabled;
+    uint32_t w, h; /* cursor plane size (DRM_CAP_CURSOR_WIDTH/HEIGHT) */
     uint32_t handle[2];
     uint32_t pitch[2];
     uint64_t size[2];
     void *map[2];
-    int front_buf; /* index of currently scanned-out buffer */
-    int pending_flip; /* whether a flip is pending */
+    int cur; /* buffer holding the current image */
+    int visible;
+    int32_t hot_x, hot_y;
+};
+
+struct drm_state {
+    int fd;
+    dev_t devnum;
+    int atomic; /* client caps set, so outputs may use atomic KMS */
+    int prime_import; /* dmabufs can be imported */
+    int fb_modifiers; /* AddFB2 takes explicit modifiers */
+
+    /* Hotplug: the udev monitor and the DRM fd share one epoll fd */
+    struct udev *udev;
+    struct udev_monitor *monitor;
+    int epoll_fd;
+
+    /* Live outputs and unplugged ones still waiting for a flip */
+    struct drm_output *outputs[BACKEND_MAX_OUTPUTS];
+    int noutputs;
+    uint32_t next_id;
+    /* A connector found no free CRTC, possibly because an unplugged
+     * output still holds one until its last flip lands */
+    int crtc_wanted;
+
+    struct drm_cursor cursor;
+
+    /* Notified from drm_dispatch() when a queued flip lands, and when
+     * outputs appear or disappear */
+    backend_flip_done_fn flip_done;
+    void *flip_done_data;
+    backend_output_fn output_fn;
+    void *output_data;
 };
 
-static struct drm_state S = {0};
+static struct drm_state S = { .fd = -1, .epoll_fd = -1 };
+
+/* The cursor is driven from the protocol thread while flips are queued and
+ * completed, and outputs hotplugged, on the render thread; this guards the
+ * cursor state, each output's mode_set and the outputs array between them */
+static pthread_mutex_t cursor_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* GEM handles from dmabuf imports are shared per DRM fd (importing the same
+ * dmabuf twice yields the same handle), so imports, which may come from
+ * any thread, run one at a time */
+static pthread_mutex_t import_lock = PTHREAD_MUTEX_INITIALIZER;
 
 /* Event cookie passed to pageflip handler */
 struct pageflip_cookie {
-    struct drm_state *s;
-    int which; /* buffer index that will become front after flip */
+    struct drm_output *o;
+    int which; /* slot that will be scanned out after flip */
 };
 
 /* Forward */
-static int create_dumb_buffer_index(int idx);
-static void destroy_dumb_buffer_index(int idx);
+static int queue_flip(struct drm_output *o, int idx);
+static void cursor_apply(struct drm_output *o);
+static void output_disable(struct drm_output *o);
+static void output_destroy(struct drm_output *o);
+static void output_removed(const struct drm_output *o);
+static void scan_connectors(void);
+
+/* Live output with the given id, or NULL */
+static struct drm_output *find_output(uint32_t id) {
+    for (int i = 0; i < S.noutputs; ++i) {
+        if (S.outputs[i]->id == id && !S.outputs[i]->gone) return S.outputs[i];
+    }
+    return NULL;
+}
+
+/* Refine the refresh period from the vblank counter and timestamp of each
+ * flip. Intervals far from the mode's nominal period (first flip after a
+ * pause with a wrapped counter, clock steps) are ignored; the rest are
+ * averaged slowly so the estimate follows the real crystal. */
+static void flip_timing(struct drm_output *o, unsigned int frame, unsigned int sec, unsigned int usec) {
+    uint64_t t = (uint64_t)sec * 1000000000u + (uint64_t)usec * 1000u;
+    if (o->last_flip_ns && t > o->last_flip_ns && frame > o->last_flip_frame) {
+        uint64_t period = (t - o->last_flip_ns) / (frame - o->last_flip_frame);
+        if (period > o->refresh_ns - o->refresh_ns / 10 && period < o->refresh_ns + o->refresh_ns / 10)
+            o->refresh_ns = (o->refresh_ns * 7 + period) / 8;
+    }
+    o->last_flip_ns = t;
+    o->last_flip_frame = frame;
+}
 
 /* Pageflip event handler */
 static void page_flip_handler(int fd, unsigned int frame, unsigned int sec, unsigned int usec, void *data) {
-    (void)fd; (void)frame; (void)sec; (void)usec;
+    (void)fd;
     struct pageflip_cookie *cookie = data;
-    struct drm_state *st = cookie->s;
-    /* flip completed: update front buffer */
-    st->front_buf = cookie->which;
-    st->pending_flip = 0;
+    struct drm_output *o = cookie->o;
+    int which = cookie->which;
     free(cookie);
-}
 
-/* Helper to find connector, encoder and CRTC */
-static int find_connector_and_crtc(void) {
-    int i;
-    drmModeConnector *conn = NULL;
-    drmModeEncoder *enc = NULL;
-    drmModeRes *res = drmModeGetResources(S.fd);
-    if (!res) {
-        fprintf(stderr, "drmModeGetResources failed\n");
-        return -1;
-    }
-    S.res = res;
-
-    for (i = 0; i < res->count_connectors; ++i) {
-        conn = drmModeGetConnector(S.fd, res->connectors[i]);
-        if (!conn) continue;
-        if (conn->connection == DRM_MODE_CONNECTED && conn->count_modes > 0) {
-            S.conn = conn;
-            S.connector_id = conn->connector_id;
-            S.mode = conn->modes[0]; /* prefer first mode */
-            break;
+    o->pending_flip = 0;
+    if (o->gone) {
+        /* the last flip of an unplugged output has landed: switch it off,
+         * announce it gone and free its buffers, and give its CRTC to a
+         * connector that wanted one (a monitor swapped on the same
+         * connector) */
+        output_disable(o);
+        output_removed(o);
+        output_destroy(o);
+        if (S.crtc_wanted) {
+            S.crtc_wanted = 0;
+            scan_connectors();
         }
-        drmModeFreeConnector(conn);
-        conn = NULL;
+        return;
     }
 
-    if (!S.conn) {
-        fprintf(stderr, "No connected connector found\n");
-        return -1;
+    /* flip completed: the queued slot is on screen, the old one is free */
+    for (int i = 0; i < SWAPCHAIN_ALL_SLOTS; ++i) {
+        if (o->sc.slots[i].state == SLOT_SCANOUT) o->sc.slots[i].state = SLOT_FREE;
     }
+    o->sc.slots[which].state = SLOT_SCANOUT;
+    o->scanout_seq = o->sc.slots[which].seq;
+    flip_timing(o, frame, sec, usec);
+    pthread_mutex_lock(&cursor_lock);
+    if (o->cursor_dirty) cursor_apply(o);
+    pthread_mutex_unlock(&cursor_lock);
 
-    /* try encoder from connector */
-    if (S.conn->encoder_id)
-        enc = drmModeGetEncoder(S.fd, S.conn->encoder_id);
-
-    if (!enc) {
-        for (i = 0; i < S.conn->count_encoders; ++i) {
-            enc = drmModeGetEncoder(S.fd, S.conn->encoders[i]);
-            if (enc) break;
-        }
-    }
-
-    if (!enc) {
-        fprintf(stderr, "No encoder found\n");
-        return -1;
-    }
-    S.enc = enc;
-
-    /* pick a CRTC compatible with encoder */
-    for (i = 0; i < res->count_crtcs; ++i) {
-        if (enc->possible_crtcs & (1 << i)) {
-            S.crtc_index = i;
-            S.crtc_id = res->crtcs[i];
-            S.crtc = drmModeGetCrtc(S.fd, S.crtc_id);
-            if (!S.crtc) {
-                fprintf(stderr, "drmModeGetCrtc failed for %u\n", S.crtc_id);
-                continue;
-            }
-            return 0;
+    /* a frame finished while this flip was in flight goes out next */
+    for (int i = 0; i < SWAPCHAIN_ALL_SLOTS; ++i) {
+        if (o->sc.slots[i].state == SLOT_READY) {
+            if (queue_flip(o, i) != 0) o->sc.slots[i].state = SLOT_FREE;
+            break;
         }
     }
 
-    fprintf(stderr, "No suitable CRTC found\n");
-    return -1;
+    if (S.flip_done)
+        S.flip_done(o->id, frame, sec, usec, S.flip_done_data);
 }
 
-static int create_dumb_buffer_index(int idx) {
+static int create_dumb_buffer_index(struct drm_output *o, int idx) {
+    struct drm_slot *sl = &o->slots[idx];
     struct drm_mode_create_dumb creq = {0};
     struct drm_mode_map_dumb mreq = {0};
     struct drm_mode_destroy_dumb dreq = {0};
     int ret;
 
-    creq.width = S.mode.hdisplay;
-    creq.height = S.mode.vdisplay;
+    creq.width = o->mode.hdisplay;
+    creq.height = o->mode.vdisplay;
     creq.bpp = 32;
 
     ret = drmIoctl(S.fd, DRM_IOCTL_MODE_CREATE_DUMB, &creq);
@@ -140,115 +261,845 @@ static int create_dumb_buffer_index(int idx) {
         return -1;
     }
 
-    S.handle[idx] = creq.handle;
-    S.pitch[idx] = creq.pitch;
-    S.size[idx] = creq.size;
+    sl->handle = creq.handle;
+    sl->pitch = creq.pitch;
+    sl->size = creq.size;
 
-    ret = drmModeAddFB(S.fd, S.mode.hdisplay, S.mode.vdisplay, 24, 32, S.pitch[idx], S.handle[idx], &S.fb_id[idx]);
+    ret = drmModeAddFB(S.fd, o->mode.hdisplay, o->mode.vdisplay, 24, 32, sl->pitch, sl->handle, &sl->fb_id);
     if (ret) {
         perror("drmModeAddFB");
-        dreq.handle = S.handle[idx];
+        dreq.handle = sl->handle;
         drmIoctl(S.fd, DRM_IOCTL_MODE_DESTROY_DUMB, &dreq);
+        sl->handle = 0;
         return -1;
     }
 
-    mreq.handle = S.handle[idx];
+    mreq.handle = sl->handle;
     ret = drmIoctl(S.fd, DRM_IOCTL_MODE_MAP_DUMB, &mreq);
     if (ret) {
         perror("DRM_IOCTL_MODE_MAP_DUMB");
-        drmModeRmFB(S.fd, S.fb_id[idx]);
-        dreq.handle = S.handle[idx];
+        drmModeRmFB(S.fd, sl->fb_id);
+        dreq.handle = sl->handle;
         drmIoctl(S.fd, DRM_IOCTL_MODE_DESTROY_DUMB, &dreq);
+        sl->fb_id = sl->handle = 0;
         return -1;
     }
 
-    S.map[idx] = mmap(0, S.size[idx], PROT_READ | PROT_WRITE, MAP_SHARED, S.fd, mreq.offset);
-    if (S.map[idx] == MAP_FAILED) {
+    sl->map = mmap(0, sl->size, PROT_READ | PROT_WRITE, MAP_SHARED, S.fd, mreq.offset);
+    if (sl->map == MAP_FAILED) {
         perror("mmap");
-        drmModeRmFB(S.fd, S.fb_id[idx]);
-        dreq.handle = S.handle[idx];
+        sl->map = NULL;
+        drmModeRmFB(S.fd, sl->fb_id);
+        dreq.handle = sl->handle;
         drmIoctl(S.fd, DRM_IOCTL_MODE_DESTROY_DUMB, &dreq);
+        sl->fb_id = sl->handle = 0;
         return -1;
     }
 
     return 0;
 }
 
-static void destroy_dumb_buffer_index(int idx) {
+static void destroy_dumb_buffer_index(struct drm_output *o, int idx) {
+    struct drm_slot *sl = &o->slots[idx];
     struct drm_mode_destroy_dumb dreq = {0};
-    if (S.map[idx] && S.map[idx] != MAP_FAILED) {
-        munmap(S.map[idx], S.size[idx]);
-        S.map[idx] = NULL;
+    if (sl->map) {
+        munmap(sl->map, sl->size);
+        sl->map = NULL;
     }
-    if (S.fb_id[idx]) {
-        drmModeRmFB(S.fd, S.fb_id[idx]);
-        S.fb_id[idx] = 0;
+    if (sl->fb_id) {
+        drmModeRmFB(S.fd, sl->fb_id);
+        sl->fb_id = 0;
     }
-    if (S.handle[idx]) {
-        dreq.handle = S.handle[idx];
+    if (sl->handle) {
+        dreq.handle = sl->handle;
         drmIoctl(S.fd, DRM_IOCTL_MODE_DESTROY_DUMB, &dreq);
-        S.handle[idx] = 0;
+        sl->handle = 0;
     }
+    o->sc.slots[idx].state = SLOT_FREE;
+    o->sc.slots[idx].age = 0;
 }
 
-/* Initialize DRM, pick connector/mode, create 2 dumb buffers */
-int drm_setup(void) {
-    const char *path = "/dev/dri/card1";
-    S.fd = open(path, O_RDWR | O_CLOEXEC);
-    if (S.fd < 0) {
-        perror("open drm device");
+/* --- atomic modesetting --- */
+
+/* Id of property `name` on a KMS object (0 if it has none); its current
+ * value is stored in *value when non-NULL */
+static uint32_t get_prop(uint32_t obj_id, uint32_t obj_type, const char *name, uint64_t *value) {
+    uint32_t id = 0;
+    drmModeObjectProperties *props = drmModeObjectGetProperties(S.fd, obj_id, obj_type);
+    if (!props) return 0;
+    for (uint32_t i = 0; i < props->count_props && !id; ++i) {
+        drmModePropertyRes *prop = drmModeGetProperty(S.fd, props->props[i]);
+        if (!prop) continue;
+        if (strcmp(prop->name, name) == 0) {
+            id = prop->prop_id;
+            if (value) *value = props->prop_values[i];
+        }
+        drmModeFreeProperty(prop);
+    }
+    drmModeFreeObjectProperties(props);
+    return id;
+}
+
+static int plane_props_init(uint32_t plane_id, struct plane_props *pp) {
+    const uint32_t t = DRM_MODE_OBJECT_PLANE;
+    pp->fb_id = get_prop(plane_id, t, "FB_ID", NULL);
+    pp->crtc_id = get_prop(plane_id, t, "CRTC_ID", NULL);
+    pp->src_x = get_prop(plane_id, t, "SRC_X", NULL);
+    pp->src_y = get_prop(plane_id, t, "SRC_Y", NULL);
+    pp->src_w = get_prop(plane_id, t, "SRC_W", NULL);
+    pp->src_h = get_prop(plane_id, t, "SRC_H", NULL);
+    pp->crtc_x = get_prop(plane_id, t, "CRTC_X", NULL);
+    pp->crtc_y = get_prop(plane_id, t, "CRTC_Y", NULL);
+    pp->crtc_w = get_prop(plane_id, t, "CRTC_W", NULL);
+    pp->crtc_h = get_prop(plane_id, t, "CRTC_H", NULL);
+    if (!pp->fb_id || !pp->crtc_id || !pp->src_x || !pp->src_y || !pp->src_w || !pp->src_h ||
+        !pp->crtc_x || !pp->crtc_y || !pp->crtc_w || !pp->crtc_h)
+        return -1;
+    return 0;
+}
+
+/* First plane of the given DRM_PLANE_TYPE_* usable on the output's CRTC,
+ * or 0 */
+static uint32_t find_plane(const struct drm_output *o, uint64_t type) {
+    uint32_t found = 0;
+    drmModePlaneRes *pres = drmModeGetPlaneResources(S.fd);
+    if (!pres) return 0;
+    for (uint32_t i = 0; i < pres->count_planes && !found; ++i) {
+        drmModePlane *plane = drmModeGetPlane(S.fd, pres->planes[i]);
+        if (!plane) continue;
+        uint64_t ptype = 0;
+        if ((plane->possible_crtcs & (1u << o->crtc_index)) &&
+            get_prop(plane->plane_id, DRM_MODE_OBJECT_PLANE, "type", &ptype) && ptype == type)
+            found = plane->plane_id;
+        drmModeFreePlane(plane);
+    }
+    drmModeFreePlaneResources(pres);
+    return found;
+}
+
+/* Point plane at fb on the output's CRTC, scanning out the whole w x h
+ * framebuffer at (x, y); fb 0 turns the plane off */
+static int plane_add(drmModeAtomicReq *req, const struct drm_output *o, uint32_t plane,
+                     const struct plane_props *pp, uint32_t fb, int32_t x, int32_t y, uint32_t w, uint32_t h) {
+    int ret = 0;
+    ret |= drmModeAtomicAddProperty(req, plane, pp->fb_id, fb) < 0;
+    ret |= drmModeAtomicAddProperty(req, plane, pp->crtc_id, fb ? o->crtc_id : 0) < 0;
+    ret |= drmModeAtomicAddProperty(req, plane, pp->src_x, 0) < 0;
+    ret |= drmModeAtomicAddProperty(req, plane, pp->src_y, 0) < 0;
+    ret |= drmModeAtomicAddProperty(req, plane, pp->src_w, (uint64_t)w << 16) < 0;
+    ret |= drmModeAtomicAddProperty(req, plane, pp->src_h, (uint64_t)h << 16) < 0;
+    ret |= drmModeAtomicAddProperty(req, plane, pp->crtc_x, (uint64_t)(int64_t)x) < 0;
+    ret |= drmModeAtomicAddProperty(req, plane, pp->crtc_y, (uint64_t)(int64_t)y) < 0;
+    ret |= drmModeAtomicAddProperty(req, plane, pp->crtc_w, w) < 0;
+    ret |= drmModeAtomicAddProperty(req, plane, pp->crtc_h, h) < 0;
+    return ret ? -1 : 0;
+}
+
+/* Commit `fb` on the output's primary plane and `ov` (bottom first) on its
+ * overlay planes, switching off those left over. With
+ * DRM_MODE_ATOMIC_ALLOW_MODESET in flags the connector, mode and CRTC are
+ * programmed in the same commit; fb 0 then switches the output off. */
+static int atomic_commit(struct drm_output *o, uint32_t fb, const struct backend_overlay *ov, int nov,
+                         uint32_t flags, void *user_data) {
+    struct drm_atomic *a = &o->atomic;
+    drmModeAtomicReq *req = drmModeAtomicAlloc();
+    if (!req) return -1;
+
+    int ret = 0;
+    if (flags & DRM_MODE_ATOMIC_ALLOW_MODESET) {
+        ret |= drmModeAtomicAddProperty(req, o->connector_id, a->conn_crtc_id, fb ? o->crtc_id : 0) < 0;
+        ret |= drmModeAtomicAddProperty(req, o->crtc_id, a->crtc_mode_id, fb ? a->mode_blob : 0) < 0;
+        ret |= drmModeAtomicAddProperty(req, o->crtc_id, a->crtc_active, fb ? 1 : 0) < 0;
+    }
+    ret |= plane_add(req, o, a->primary_plane, &a->primary, fb, 0, 0,
+                     o->mode.hdisplay, o->mode.vdisplay) != 0;
+    for (int i = 0; i < a->noverlays; ++i) {
+        if (i < nov)
+            ret |= plane_add(req, o, a->overlay_plane[i], &a->overlay[i], ov[i].fb_id, ov[i].x, ov[i].y,
+                             ov[i].width, ov[i].height) != 0;
+        else
+            ret |= plane_add(req, o, a->overlay_plane[i], &a->overlay[i], 0, 0, 0, 0, 0) != 0;
+    }
+    if (!ret)
+        ret = drmModeAtomicCommit(S.fd, req, flags, user_data);
+    else
+        errno = EINVAL;
+
+    drmModeAtomicFree(req);
+    return ret ? -1 : 0;
+}
+
+/* Whether another output drives plane as an overlay */
+static int overlay_plane_claimed(uint32_t plane) {
+    for (int i = 0; i < S.noutputs; ++i) {
+        const struct drm_atomic *a = &S.outputs[i]->atomic;
+        for (int j = 0; a->enabled && j < a->noverlays; ++j) {
+            if (a->overlay_plane[j] == plane) return 1;
+        }
+    }
+    return 0;
+}
+
+/* Claim up to BACKEND_MAX_OVERLAYS overlay planes above the primary that
+ * the output's CRTC can use and no other output has, sorted by zpos
+ * (planes without one keep their enumeration order) */
+static void overlay_planes_init(struct drm_output *o) {
+    struct drm_atomic *a = &o->atomic;
+    uint64_t zpos[BACKEND_MAX_OVERLAYS], primary_zpos = 0;
+    a->noverlays = 0;
+    get_prop(a->primary_plane, DRM_MODE_OBJECT_PLANE, "zpos", &primary_zpos);
+
+    drmModePlaneRes *pres = drmModeGetPlaneResources(S.fd);
+    if (!pres) return;
+    for (uint32_t i = 0; i < pres->count_planes && a->noverlays < BACKEND_MAX_OVERLAYS; ++i) {
+        uint32_t id = pres->planes[i];
+        drmModePlane *plane = drmModeGetPlane(S.fd, id);
+        if (!plane) continue;
+        int usable = (plane->possible_crtcs & (1u << o->crtc_index)) != 0;
+        drmModeFreePlane(plane);
+
+        uint64_t ptype = 0, z = primary_zpos;
+        struct plane_props pp;
+        if (!usable || !get_prop(id, DRM_MODE_OBJECT_PLANE, "type", &ptype) || ptype != DRM_PLANE_TYPE_OVERLAY ||
+            overlay_plane_claimed(id) || plane_props_init(id, &pp) != 0)
+            continue;
+        if (get_prop(id, DRM_MODE_OBJECT_PLANE, "zpos", &z) && z < primary_zpos) continue;
+
+        int n = a->noverlays++;
+        for (; n > 0 && zpos[n - 1] > z; --n) {
+            a->overlay_plane[n] = a->overlay_plane[n - 1];
+            a->overlay[n] = a->overlay[n - 1];
+            zpos[n] = zpos[n - 1];
+        }
+        a->overlay_plane[n] = id;
+        a->overlay[n] = pp;
+        zpos[n] = z;
+    }
+    drmModeFreePlaneResources(pres);
+}
+
+/* Drive the output with atomic KMS if the device allows it and a
+ * TEST_ONLY commit of its mode on the first slot passes. Returns -1 to stay
+ * on legacy KMS. */
+static int atomic_init(struct drm_output *o) {
+    struct drm_atomic *a = &o->atomic;
+    a->enabled = 0;
+    if (!S.atomic) return -1;
+
+    a->primary_plane = find_plane(o, DRM_PLANE_TYPE_PRIMARY);
+    if (!a->primary_plane || plane_props_init(a->primary_plane, &a->primary) != 0) {
+        fprintf(stderr, "atomic: no usable primary plane for %s\n", o->name);
+        return -1;
+    }
+    a->conn_crtc_id = get_prop(o->connector_id, DRM_MODE_OBJECT_CONNECTOR, "CRTC_ID", NULL);
+    a->crtc_mode_id = get_prop(o->crtc_id, DRM_MODE_OBJECT_CRTC, "MODE_ID", NULL);
+    a->crtc_active = get_prop(o->crtc_id, DRM_MODE_OBJECT_CRTC, "ACTIVE", NULL);
+    if (!a->conn_crtc_id || !a->crtc_mode_id || !a->crtc_active) {
+        fprintf(stderr, "atomic: missing connector/CRTC properties for %s\n", o->name);
+        return -1;
+    }
+
+    if (drmModeCreatePropertyBlob(S.fd, &o->mode, sizeof(o->mode), &a->mode_blob) != 0) {
+        perror("drmModeCreatePropertyBlob");
+        return -1;
+    }
+
+    if (atomic_commit(o, o->slots[0].fb_id, NULL, 0, DRM_MODE_ATOMIC_TEST_ONLY | DRM_MODE_ATOMIC_ALLOW_MODESET,
+                      NULL) != 0) {
+        perror("atomic: TEST_ONLY modeset");
+        drmModeDestroyPropertyBlob(S.fd, a->mode_blob);
+        a->mode_blob = 0;
         return -1;
     }
 
-    if (find_connector_and_crtc() != 0) {
-        close(S.fd);
-        S.fd = -1;
+    a->enabled = 1;
+    overlay_planes_init(o);
+    return 0;
+}
+
+/* --- hardware cursor --- */
+
+static int create_cursor_bo(int idx) {
+    struct drm_cursor *c = &S.cursor;
+    struct drm_mode_create_dumb creq = {0};
+    struct drm_mode_map_dumb mreq = {0};
+    struct drm_mode_destroy_dumb dreq = {0};
+
+    creq.width = c->w;
+    creq.height = c->h;
+    creq.bpp = 32;
+    if (drmIoctl(S.fd, DRM_IOCTL_MODE_CREATE_DUMB, &creq)) {
+        perror("cursor DRM_IOCTL_MODE_CREATE_DUMB");
         return -1;
     }
+    c->handle[idx] = creq.handle;
+    c->pitch[idx] = creq.pitch;
+    c->size[idx] = creq.size;
+
+    mreq.handle = creq.handle;
+    if (drmIoctl(S.fd, DRM_IOCTL_MODE_MAP_DUMB, &mreq) == 0) {
+        c->map[idx] = mmap(0, c->size[idx], PROT_READ | PROT_WRITE, MAP_SHARED, S.fd, mreq.offset);
+        if (c->map[idx] != MAP_FAILED) {
+            memset(c->map[idx], 0, c->size[idx]);
+            return 0;
+        }
+    }
+    perror("cursor map");
+    c->map[idx] = NULL;
+    dreq.handle = creq.handle;
+    drmIoctl(S.fd, DRM_IOCTL_MODE_DESTROY_DUMB, &dreq);
+    c->handle[idx] = 0;
+    return -1;
+}
+
+static void destroy_cursor_bo(int idx) {
+    struct drm_cursor *c = &S.cursor;
+    struct drm_mode_destroy_dumb dreq = {0};
+    if (c->map[idx]) {
+        munmap(c->map[idx], c->size[idx]);
+        c->map[idx] = NULL;
+    }
+    if (c->handle[idx]) {
+        dreq.handle = c->handle[idx];
+        drmIoctl(S.fd, DRM_IOCTL_MODE_DESTROY_DUMB, &dreq);
+        c->handle[idx] = 0;
+    }
+}
+
+static void cursor_init(void) {
+    struct drm_cursor *c = &S.cursor;
+    uint64_t w = 64, h = 64;
+    drmGetCap(S.fd, DRM_CAP_CURSOR_WIDTH, &w);
+    drmGetCap(S.fd, DRM_CAP_CURSOR_HEIGHT, &h);
+    c->w = (uint32_t)w;
+    c->h = (uint32_t)h;
 
-    /* Create two buffers */
     for (int i = 0; i < 2; ++i) {
-        if (create_dumb_buffer_index(i) != 0) {
-            for (int j = 0; j < i; ++j) destroy_dumb_buffer_index(j);
-            if (S.crtc) drmModeFreeCrtc(S.crtc);
-            if (S.enc) drmModeFreeEncoder(S.enc);
-            if (S.conn) drmModeFreeConnector(S.conn);
-            if (S.res) drmModeFreeResources(S.res);
-            close(S.fd);
-            S.fd = -1;
-            return -1;
+        if (create_cursor_bo(i) != 0) {
+            for (int j = 0; j < i; ++j) destroy_cursor_bo(j);
+            fprintf(stderr, "DRM: no hardware cursor\n");
+            return;
         }
     }
+    c->enabled = 1;
+}
+
+/* Push image and position to the output's cursor plane. The cursor is
+ * independent of the primary plane, so this never touches the swapchain.
+ * Called with cursor_lock held. */
+static void cursor_apply(struct drm_output *o) {
+    struct drm_cursor *c = &S.cursor;
+    if (!c->enabled) return;
+    if (!o->mode_set) {
+        o->cursor_dirty = 1;
+        return;
+    }
+    o->cursor_dirty = 0;
+
+    uint32_t handle = c->visible ? c->handle[c->cur] : 0;
+    if (drmModeSetCursor2(S.fd, o->crtc_id, handle, c->w, c->h, c->hot_x, c->hot_y) != 0 &&
+        drmModeSetCursor(S.fd, o->crtc_id, handle, c->w, c->h) != 0) {
+        perror("drmModeSetCursor");
+        return;
+    }
+    if (c->visible)
+        drmModeMoveCursor(S.fd, o->crtc_id, o->cursor_x - c->hot_x, o->cursor_y - c->hot_y);
+}
 
-    S.front_buf = 0;
-    S.pending_flip = 0;
+int drm_cursor_set_image(const void *argb, uint32_t stride, uint32_t width, uint32_t height,
+                         int32_t hot_x, int32_t hot_y) {
+    struct drm_cursor *c = &S.cursor;
+    if (!c->enabled) return -1;
 
+    pthread_mutex_lock(&cursor_lock);
+    if (!argb) {
+        c->visible = 0;
+    } else {
+        /* draw into the buffer not currently shown, clipped to the plane */
+        int next = c->cur ^ 1;
+        uint8_t *dst = c->map[next];
+        const uint8_t *src = argb;
+        if (width > c->w) width = c->w;
+        if (height > c->h) height = c->h;
+        stream_fill32((uint32_t *)dst, 0, c->size[next] / 4);
+        for (uint32_t y = 0; y < height; ++y)
+            stream_copy(dst + (size_t)y * c->pitch[next], src + (size_t)y * stride, (size_t)width * 4);
+        stream_fence();
+
+        c->cur = next;
+        c->visible = 1;
+        c->hot_x = hot_x;
+        c->hot_y = hot_y;
+    }
+    for (int i = 0; i < S.noutputs; ++i) {
+        if (!S.outputs[i]->gone) cursor_apply(S.outputs[i]);
+    }
+    pthread_mutex_unlock(&cursor_lock);
     return 0;
 }
 
-/* Tear down all resources */
-void drm_teardown(void) {
-    for (int i = 0; i < 2; ++i) destroy_dumb_buffer_index(i);
-    if (S.crtc) {
-        drmModeFreeCrtc(S.crtc);
-        S.crtc = NULL;
+int drm_cursor_move(uint32_t output, int32_t x, int32_t y) {
+    struct drm_cursor *c = &S.cursor;
+    if (!c->enabled) return -1;
+    int ret = 0;
+    pthread_mutex_lock(&cursor_lock);
+    struct drm_output *o = find_output(output);
+    if (!o) {
+        ret = -1;
+    } else {
+        o->cursor_x = x;
+        o->cursor_y = y;
+        if (c->visible) {
+            if (o->mode_set) ret = drmModeMoveCursor(S.fd, o->crtc_id, x - c->hot_x, y - c->hot_y);
+            else o->cursor_dirty = 1;
+        }
     }
-    if (S.enc) {
-        drmModeFreeEncoder(S.enc);
-        S.enc = NULL;
+    pthread_mutex_unlock(&cursor_lock);
+    return ret;
+}
+
+static uint32_t mode_refresh_mhz(const drmModeModeInfo *mode) {
+    uint64_t total = (uint64_t)mode->htotal * mode->vtotal;
+    return total ? (uint32_t)((uint64_t)mode->clock * 1000000u / total) : 60000;
+}
+
+static void output_info(const struct drm_output *o, struct backend_output_info *info) {
+    memset(info, 0, sizeof(*info));
+    info->id = o->id;
+    info->width = o->mode.hdisplay;
+    info->height = o->mode.vdisplay;
+    info->refresh_mhz = mode_refresh_mhz(&o->mode);
+    memcpy(info->name, o->name, sizeof(info->name));
+}
+
+/* --- shadow framebuffer --- */
+
+static void shadow_init(struct drm_output *o) {
+    const char *env = getenv("ARGUS_SHADOW");
+    if (env && strcmp(env, "0") == 0) return;
+
+    /* whole cache lines per row */
+    uint32_t pitch = ((uint32_t)o->mode.hdisplay * 4 + 63) & ~63u;
+    size_t size = (size_t)pitch * o->mode.vdisplay;
+    size_t huge = (size + SHADOW_HUGE_PAGE - 1) & ~((size_t)SHADOW_HUGE_PAGE - 1);
+
+    /* reserved huge pages first, then transparent huge pages */
+    void *p = mmap(NULL, huge, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p == MAP_FAILED) {
+        p = mmap(NULL, huge, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            perror("shadow framebuffer mmap");
+            return;
+        }
+        madvise(p, huge, MADV_HUGEPAGE);
     }
-    if (S.conn) {
-        drmModeFreeConnector(S.conn);
-        S.conn = NULL;
+    o->shadow = p;
+    o->shadow_pitch = pitch;
+    o->shadow_size = huge;
+}
+
+static void shadow_fini(struct drm_output *o) {
+    if (o->shadow) munmap(o->shadow, o->shadow_size);
+    o->shadow = NULL;
+    o->shadow_pitch = 0;
+    o->shadow_size = 0;
+}
+
+/* Stream the rectangles of rg from the shadow into slot idx */
+static void shadow_upload(struct drm_output *o, int idx, const struct region *rg) {
+    struct drm_slot *sl = &o->slots[idx];
+    for (int i = 0; i < rg->n; ++i) {
+        const struct rect *r = &rg->r[i];
+        size_t off = (size_t)r->x1 * 4;
+        size_t len = (size_t)(r->x2 - r->x1) * 4;
+        for (int32_t y = r->y1; y < r->y2; ++y)
+            stream_copy(sl->map + (size_t)y * sl->pitch + off, o->shadow + (size_t)y * o->shadow_pitch + off, len);
     }
-    if (S.res) {
-        drmModeFreeResources(S.res);
-        S.res = NULL;
+}
+
+/* --- outputs --- */
+
+static const char *connector_type_name(uint32_t type) {
+    switch (type) {
+    case DRM_MODE_CONNECTOR_VGA: return "VGA";
+    case DRM_MODE_CONNECTOR_DVII: return "DVI-I";
+    case DRM_MODE_CONNECTOR_DVID: return "DVI-D";
+    case DRM_MODE_CONNECTOR_DisplayPort: return "DP";
+    case DRM_MODE_CONNECTOR_HDMIA: return "HDMI-A";
+    case DRM_MODE_CONNECTOR_HDMIB: return "HDMI-B";
+    case DRM_MODE_CONNECTOR_eDP: return "eDP";
+    case DRM_MODE_CONNECTOR_VIRTUAL: return "Virtual";
+    case DRM_MODE_CONNECTOR_DSI: return "DSI";
+    case DRM_MODE_CONNECTOR_DPI: return "DPI";
+    case DRM_MODE_CONNECTOR_WRITEBACK: return "Writeback";
+    default: return "Unknown";
+    }
+}
+
+/* Live output driving connector_id, or NULL */
+static struct drm_output *output_for_connector(uint32_t connector_id) {
+    for (int i = 0; i < S.noutputs; ++i) {
+        if (S.outputs[i]->connector_id == connector_id && !S.outputs[i]->gone) return S.outputs[i];
     }
-    if (S.fd >= 0) {
-        close(S.fd);
-        S.fd = -1;
+    return NULL;
+}
+
+static int crtc_in_use(uint32_t crtc_id) {
+    for (int i = 0; i < S.noutputs; ++i) {
+        if (S.outputs[i]->crtc_id == crtc_id) return 1;
+    }
+    return 0;
+}
+
+/* A CRTC no other output uses that can drive conn, by index into
+ * res->crtcs, or -1 */
+static int pick_crtc(drmModeRes *res, drmModeConnector *conn) {
+    for (int i = 0; i < conn->count_encoders; ++i) {
+        drmModeEncoder *enc = drmModeGetEncoder(S.fd, conn->encoders[i]);
+        if (!enc) continue;
+        uint32_t possible = enc->possible_crtcs;
+        drmModeFreeEncoder(enc);
+        for (int j = 0; j < res->count_crtcs; ++j) {
+            if ((possible & (1u << j)) && !crtc_in_use(res->crtcs[j])) return j;
+        }
+    }
+    return -1;
+}
+
+/* Preferred mode of the connector, else its first */
+static const drmModeModeInfo *pick_mode(const drmModeConnector *conn) {
+    for (int i = 0; i < conn->count_modes; ++i) {
+        if (conn->modes[i].type & DRM_MODE_TYPE_PREFERRED) return &conn->modes[i];
+    }
+    return &conn->modes[0];
+}
+
+/* Release everything an output holds and drop it from the outputs array.
+ * Its flips must have landed. */
+static void output_destroy(struct drm_output *o) {
+    for (int i = 0; i < o->sc.nslots; ++i) destroy_dumb_buffer_index(o, i);
+    shadow_fini(o);
+    if (o->atomic.mode_blob) drmModeDestroyPropertyBlob(S.fd, o->atomic.mode_blob);
+
+    pthread_mutex_lock(&cursor_lock);
+    for (int i = 0; i < S.noutputs; ++i) {
+        if (S.outputs[i] != o) continue;
+        S.outputs[i] = S.outputs[--S.noutputs];
+        break;
     }
+    pthread_mutex_unlock(&cursor_lock);
+    free(o);
+}
+
+/* Light nothing on the output's CRTC any more, so it can be reused */
+static void output_disable(struct drm_output *o) {
+    if (!o->mode_set) return;
+    if (S.cursor.enabled) drmModeSetCursor(S.fd, o->crtc_id, 0, 0, 0);
+    if (o->atomic.enabled) {
+        if (atomic_commit(o, 0, NULL, 0, DRM_MODE_ATOMIC_ALLOW_MODESET, NULL) != 0)
+            perror("atomic: disable output");
+    } else if (drmModeSetCrtc(S.fd, o->crtc_id, 0, 0, 0, NULL, 0, NULL) != 0) {
+        perror("drmModeSetCrtc disable");
+    }
+    pthread_mutex_lock(&cursor_lock);
+    o->mode_set = 0;
+    pthread_mutex_unlock(&cursor_lock);
+}
+
+/* Set up an output for a newly connected connector. Its CRTC is only
+ * programmed by the first frame submitted to it. */
+static struct drm_output *output_create(drmModeRes *res, drmModeConnector *conn) {
+    if (S.noutputs == BACKEND_MAX_OUTPUTS) {
+        fprintf(stderr, "DRM: too many outputs, ignoring connector %u\n", conn->connector_id);
+        return NULL;
+    }
+    int crtc = pick_crtc(res, conn);
+    if (crtc < 0) {
+        fprintf(stderr, "DRM: no free CRTC for connector %u\n", conn->connector_id);
+        S.crtc_wanted = 1;
+        return NULL;
+    }
+
+    struct drm_output *o = calloc(1, sizeof(*o));
+    if (!o) return NULL;
+    o->connector_id = conn->connector_id;
+    o->crtc_index = (uint32_t)crtc;
+    o->crtc_id = res->crtcs[crtc];
+    o->mode = *pick_mode(conn);
+    snprintf(o->name, sizeof(o->name), "%s-%u", connector_type_name(conn->connector_type), conn->connector_type_id);
+    o->refresh_ns = 1000000000000ull / mode_refresh_mhz(&o->mode);
+    o->cursor_x = o->mode.hdisplay / 2;
+    o->cursor_y = o->mode.vdisplay / 2;
+
+    swapchain_init(&o->sc);
+    for (int i = 0; i < o->sc.nslots; ++i) {
+        if (create_dumb_buffer_index(o, i) != 0) {
+            for (int j = 0; j < i; ++j) destroy_dumb_buffer_index(o, j);
+            free(o);
+            return NULL;
+        }
+    }
+    atomic_init(o);
+    shadow_init(o);
+
+    o->id = ++S.next_id;
+    pthread_mutex_lock(&cursor_lock);
+    S.outputs[S.noutputs++] = o;
+    pthread_mutex_unlock(&cursor_lock);
+
+    printf("DRM: output %u %s %ux%u@%u CRTC %u, %s modesetting, %d overlay planes%s\n", o->id, o->name,
+           o->mode.hdisplay, o->mode.vdisplay, (mode_refresh_mhz(&o->mode) + 500) / 1000, o->crtc_id,
+           o->atomic.enabled ? "atomic" : "legacy", o->atomic.noverlays, o->shadow ? ", shadow framebuffer" : "");
+    return o;
+}
+
+/* Announce an unplugged output gone. Its CRTC and planes must be off:
+ * the protocol side then releases the client buffers they showed, and
+ * their framebuffers may be removed right away. */
+static void output_removed(const struct drm_output *o) {
+    if (!S.output_fn) return;
+    struct backend_output_info info;
+    output_info(o, &info);
+    S.output_fn(0, &info, S.output_data);
+}
+
+/* The connector went away: forget the output, and switch it off, announce
+ * it gone and free it once nothing scans out of it */
+static void output_unplug(struct drm_output *o) {
+    printf("DRM: output %u %s disconnected\n", o->id, o->name);
+    pthread_mutex_lock(&cursor_lock);
+    o->gone = 1;
+    pthread_mutex_unlock(&cursor_lock);
+    if (o->pending_flip) return; /* page_flip_handler finishes it */
+    output_disable(o);
+    output_removed(o);
+    output_destroy(o);
+}
+
+/* Match the outputs to the connectors that are connected now */
+static void scan_connectors(void) {
+    drmModeRes *res = drmModeGetResources(S.fd);
+    if (!res) {
+        fprintf(stderr, "drmModeGetResources failed\n");
+        return;
+    }
+
+    for (int i = 0; i < res->count_connectors; ++i) {
+        drmModeConnector *conn = drmModeGetConnector(S.fd, res->connectors[i]);
+        if (!conn) continue;
+        int connected = conn->connection == DRM_MODE_CONNECTED && conn->count_modes > 0;
+        struct drm_output *o = output_for_connector(conn->connector_id);
+
+        /* a new preferred mode (another monitor) is an unplug and a plug */
+        if (o && connected) {
+            const drmModeModeInfo *m = pick_mode(conn);
+            if (m->hdisplay != o->mode.hdisplay || m->vdisplay != o->mode.vdisplay || m->clock != o->mode.clock) {
+                output_unplug(o);
+                o = NULL;
+            }
+        } else if (o) {
+            output_unplug(o);
+            o = NULL;
+        }
+        if (!o && connected) {
+            o = output_create(res, conn);
+            if (o && S.output_fn) {
+                struct backend_output_info info;
+                output_info(o, &info);
+                S.output_fn(1, &info, S.output_data);
+            }
+        }
+        drmModeFreeConnector(conn);
+    }
+    drmModeFreeResources(res);
+}
+
+/* --- device --- */
+
+/* Open a KMS device node; returns the fd or -1 */
+static int open_card(const char *path) {
+    int fd = open(path, O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    drmModeRes *res = drmModeGetResources(fd);
+    if (!res) {
+        close(fd);
+        return -1;
+    }
+    drmModeFreeResources(res);
+    return fd;
+}
+
+/* Whether any connector of the device is connected */
+static int card_connected(int fd) {
+    int found = 0;
+    drmModeRes *res = drmModeGetResources(fd);
+    if (!res) return 0;
+    for (int i = 0; i < res->count_connectors && !found; ++i) {
+        drmModeConnector *conn = drmModeGetConnector(fd, res->connectors[i]);
+        if (!conn) continue;
+        found = conn->connection == DRM_MODE_CONNECTED && conn->count_modes > 0;
+        drmModeFreeConnector(conn);
+    }
+    drmModeFreeResources(res);
+    return found;
+}
+
+/* Pick the KMS device of seat0 to drive: ARGUS_DRM_DEVICE if set, else the
+ * first card with a connected connector, preferring the boot VGA device.
+ * Fills S.fd and S.devnum. */
+static int open_device(void) {
+    struct stat st;
+    const char *env = getenv("ARGUS_DRM_DEVICE");
+    if (env) {
+        S.fd = open_card(env);
+        if (S.fd < 0) return -1;
+        if (fstat(S.fd, &st) == 0) S.devnum = st.st_rdev;
+        printf("DRM: using %s\n", env);
+        return 0;
+    }
+
+    struct udev_enumerate *e = udev_enumerate_new(S.udev);
+    if (!e) return -1;
+    udev_enumerate_add_match_subsystem(e, "drm");
+    udev_enumerate_add_match_sysname(e, "card[0-9]*");
+    udev_enumerate_scan_devices(e);
+
+    int best_fd = -1, best_score = -1;
+    dev_t best_devnum = 0;
+    char best_path[256] = "";
+    struct udev_list_entry *entry;
+    udev_list_entry_foreach(entry, udev_enumerate_get_list_entry(e)) {
+        struct udev_device *dev = udev_device_new_from_syspath(S.udev, udev_list_entry_get_name(entry));
+        if (!dev) continue;
+        const char *node = udev_device_get_devnode(dev);
+        const char *seat = udev_device_get_property_value(dev, "ID_SEAT");
+        if (!node || (seat && strcmp(seat, "seat0") != 0)) {
+            udev_device_unref(dev);
+            continue;
+        }
+
+        int fd = open_card(node);
+        if (fd < 0) {
+            udev_device_unref(dev);
+            continue;
+        }
+        int score = card_connected(fd) ? 2 : 0;
+        struct udev_device *pci = udev_device_get_parent_with_subsystem_devtype(dev, "pci", NULL);
+        const char *boot_vga = pci ? udev_device_get_sysattr_value(pci, "boot_vga") : NULL;
+        if (boot_vga && strcmp(boot_vga, "1") == 0) score++;
+
+        if (score > best_score) {
+            if (best_fd >= 0) close(best_fd);
+            best_fd = fd;
+            best_score = score;
+            best_devnum = udev_device_get_devnum(dev);
+            snprintf(best_path, sizeof(best_path), "%s", node);
+        } else {
+            close(fd);
+        }
+        udev_device_unref(dev);
+    }
+    udev_enumerate_unref(e);
+
+    if (best_fd < 0) {
+        fprintf(stderr, "DRM: no KMS device found\n");
+        return -1;
+    }
+    S.fd = best_fd;
+    S.devnum = best_devnum;
+    printf("DRM: using %s\n", best_path);
+    return 0;
+}
+
+/* Watch for connector changes on our device */
+static void hotplug_init(void) {
+    S.monitor = udev_monitor_new_from_netlink(S.udev, "udev");
+    if (!S.monitor) goto fail;
+    if (udev_monitor_filter_add_match_subsystem_devtype(S.monitor, "drm", "drm_minor") < 0 ||
+        udev_monitor_enable_receiving(S.monitor) < 0)
+        goto fail;
+    struct epoll_event ev = {.events = EPOLLIN, .data.fd = udev_monitor_get_fd(S.monitor)};
+    if (epoll_ctl(S.epoll_fd, EPOLL_CTL_ADD, ev.data.fd, &ev) != 0) goto fail;
+    return;
+
+fail:
+    fprintf(stderr, "DRM: no hotplug monitor\n");
+    if (S.monitor) udev_monitor_unref(S.monitor);
+    S.monitor = NULL;
+}
+
+static void handle_uevent(void) {
+    struct udev_device *dev = udev_monitor_receive_device(S.monitor);
+    if (!dev) return;
+    const char *hotplug = udev_device_get_property_value(dev, "HOTPLUG");
+    if (udev_device_get_devnum(dev) == S.devnum && hotplug && strcmp(hotplug, "1") == 0)
+        scan_connectors();
+    udev_device_unref(dev);
+}
+
+static void device_close(void) {
+    if (S.monitor) udev_monitor_unref(S.monitor);
+    S.monitor = NULL;
+    if (S.udev) udev_unref(S.udev);
+    S.udev = NULL;
+    if (S.epoll_fd >= 0) close(S.epoll_fd);
+    S.epoll_fd = -1;
+    if (S.fd >= 0) close(S.fd);
+    S.fd = -1;
+}
+
+/* Open the device, light nothing yet, and create an output per connected
+ * connector */
+int drm_setup(void) {
+    S.udev = udev_new();
+    if (!S.udev) {
+        fprintf(stderr, "udev_new failed\n");
+        return -1;
+    }
+    if (open_device() != 0) {
+        device_close();
+        return -1;
+    }
+
+    /* flip timestamps are handed to clients as CLOCK_MONOTONIC times */
+    uint64_t cap = 0;
+    if (drmGetCap(S.fd, DRM_CAP_TIMESTAMP_MONOTONIC, &cap) != 0 || !cap)
+        fprintf(stderr, "DRM flip timestamps are not CLOCK_MONOTONIC\n");
+
+    S.prime_import = drmGetCap(S.fd, DRM_CAP_PRIME, &cap) == 0 && (cap & DRM_PRIME_CAP_IMPORT);
+    S.fb_modifiers = drmGetCap(S.fd, DRM_CAP_ADDFB2_MODIFIERS, &cap) == 0 && cap;
+
+    S.atomic = !getenv("ARGUS_LEGACY_KMS") &&
+               drmSetClientCap(S.fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1) == 0 &&
+               drmSetClientCap(S.fd, DRM_CLIENT_CAP_ATOMIC, 1) == 0;
+
+    S.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event ev = {.events = EPOLLIN, .data.fd = S.fd};
+    if (S.epoll_fd < 0 || epoll_ctl(S.epoll_fd, EPOLL_CTL_ADD, S.fd, &ev) != 0) {
+        perror("DRM: epoll");
+        device_close();
+        return -1;
+    }
+
+    cursor_init();
+    hotplug_init();
+    scan_connectors();
+    if (S.noutputs == 0) {
+        fprintf(stderr, "No connected connector found\n");
+        drm_teardown();
+        return -1;
+    }
+    return 0;
+}
+
+static int any_flip_pending(void) {
+    for (int i = 0; i < S.noutputs; ++i) {
+        if (S.outputs[i]->pending_flip) return 1;
+    }
+    return 0;
 }
 
 /* Helper to block until no flip is pending (process events) */
@@ -257,7 +1108,7 @@ static int wait_for_vblank_completion(int timeout_ms) {
     pfd.fd = S.fd;
     pfd.events = POLLIN;
 retry:
-    if (!S.pending_flip) return 0;
+    if (!any_flip_pending()) return 0;
     int ret = poll(&pfd, 1, timeout_ms);
     if (ret < 0) {
         if (errno == EINTR) goto retry;
@@ -272,127 +1123,328 @@ retry:
             .version = DRM_EVENT_CONTEXT_VERSION,
             .page_flip_handler = page_flip_handler
         };
-        if (drmHandleEvent(S.fd, &evctx) != 0) {
-            perror("drmHandleEvent");
-            return -1;
-        }
+        if (drmHandleEvent(S.fd, &evctx) != 0) return -1;
+        goto retry;
     }
-    return 0;
 }
 
-/* Fill the non-front buffer with colour and schedule pageflip.
- * This function does not block except to process the flip event if wait==1.
- */
-int drm_present_solid(uint32_t r, uint32_t g, uint32_t b) {
-    if (!S.map[0] || !S.map[1]) return -1;
-
-    int back = S.front_buf ^ 1;
-    uint32_t width = S.mode.hdisplay;
-    uint32_t height = S.mode.vdisplay;
-    uint32_t pitch = S.pitch[back];
-    uint8_t *p = S.map[back];
-    uint32_t color = (0xff << 24) | (r << 16) | (g << 8) | b;
-
-    for (uint32_t y = 0; y < height; ++y) {
-        uint32_t *row = (uint32_t *)(p + y * pitch);
-        for (uint32_t x = 0; x < width; ++x) {
-            row[x] = color;
-        }
-    }
+/* Tear down all resources */
+void drm_teardown(void) {
+    /* let in-flight flips land so their cookies are freed and the fbs idle */
+    S.flip_done = NULL;
+    S.output_fn = NULL;
+    S.crtc_wanted = 0;
+    if (S.fd >= 0 && wait_for_vblank_completion(1000) != 0)
+        fprintf(stderr, "drm_teardown: pageflip did not complete\n");
 
-    /* If this is the first time, setcrtc to back buffer synchronously */
-    if (!S.crtc || S.crtc->buffer_id == 0) {
-        int ret = drmModeSetCrtc(S.fd, S.crtc_id, S.fb_id[back], 0, 0,
-                                 &S.connector_id, 1, &S.mode);
-        if (ret) {
-            perror("drmModeSetCrtc initial");
-            return -1;
-        }
-        S.front_buf = back;
-        return 0;
+    while (S.noutputs > 0) {
+        struct drm_output *o = S.outputs[S.noutputs - 1];
+        if (S.cursor.enabled && o->mode_set)
+            drmModeSetCursor(S.fd, o->crtc_id, 0, 0, 0);
+        output_destroy(o);
     }
+    for (int i = 0; i < 2; ++i) destroy_cursor_bo(i);
+    memset(&S.cursor, 0, sizeof(S.cursor));
+    S.atomic = 0;
+    S.prime_import = S.fb_modifiers = 0;
+    device_close();
+}
 
-    /* Schedule pageflip to back buffer with event handler */
+/* Queue a pageflip to slot idx; completion arrives through drm_dispatch().
+ * With atomic KMS the first flip also performs the modeset, nonblocking. */
+static int queue_flip(struct drm_output *o, int idx) {
     struct pageflip_cookie *cookie = malloc(sizeof(*cookie));
     if (!cookie) return -1;
-    cookie->s = &S;
-    cookie->which = back;
-    int ret = drmModePageFlip(S.fd, S.crtc_id, S.fb_id[back], DRM_MODE_PAGE_FLIP_EVENT, cookie);
+    cookie->o = o;
+    cookie->which = idx;
+    int ret;
+    if (o->atomic.enabled) {
+        uint32_t flags = DRM_MODE_ATOMIC_NONBLOCK | DRM_MODE_PAGE_FLIP_EVENT;
+        if (!o->mode_set) flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
+        const struct drm_slot *sl = &o->slots[idx];
+        ret = atomic_commit(o, sl->fb_id, sl->overlays, sl->noverlays, flags, cookie);
+        if (ret) perror("drmModeAtomicCommit");
+    } else {
+        ret = drmModePageFlip(S.fd, o->crtc_id, o->slots[idx].fb_id, DRM_MODE_PAGE_FLIP_EVENT, cookie);
+        if (ret) perror("drmModePageFlip");
+    }
     if (ret) {
-        perror("drmModePageFlip");
         free(cookie);
         return -1;
     }
-    S.pending_flip = 1;
+    o->sc.slots[idx].state = SLOT_QUEUED;
+    o->pending_flip = 1;
+    pthread_mutex_lock(&cursor_lock);
+    o->mode_set = 1;
+    pthread_mutex_unlock(&cursor_lock);
+    return 0;
+}
 
-    /* process events until flip completes */
-    while (S.pending_flip) {
-        int w = wait_for_vblank_completion(5000);
-        if (w < 0) return -1;
-        if (w == 1) {
-            fprintf(stderr, "Timeout waiting for pageflip\n");
+/* A newer frame is in slot idx: one still waiting as READY elsewhere will
+ * never be shown */
+static void drop_ready(struct drm_output *o, int idx) {
+    for (int i = 0; i < SWAPCHAIN_ALL_SLOTS; ++i) {
+        if (i != idx && o->sc.slots[i].state == SLOT_READY) o->sc.slots[i].state = SLOT_FREE;
+    }
+}
+
+/* Hand a freshly drawn slot to the display. On legacy KMS the first frame
+ * programs the CRTC synchronously; otherwise the slot is flipped on the next
+ * vblank, or parked as READY until the flip in flight lands. Never waits
+ * for vblank.
+ */
+static int submit_slot(struct drm_output *o, int idx) {
+    if (!o->mode_set && !o->atomic.enabled) {
+        int ret = drmModeSetCrtc(S.fd, o->crtc_id, o->slots[idx].fb_id, 0, 0,
+                                 &o->connector_id, 1, &o->mode);
+        if (ret) {
+            perror("drmModeSetCrtc initial");
+            o->sc.slots[idx].state = SLOT_FREE;
             return -1;
         }
+        o->sc.slots[idx].state = SLOT_SCANOUT;
+        o->scanout_seq = o->sc.slots[idx].seq;
+        pthread_mutex_lock(&cursor_lock);
+        o->mode_set = 1;
+        if (o->cursor_dirty) cursor_apply(o);
+        pthread_mutex_unlock(&cursor_lock);
+        return 0;
     }
 
+    if (o->pending_flip) {
+        o->sc.slots[idx].state = SLOT_READY;
+        return 0;
+    }
+    if (queue_flip(o, idx) != 0) {
+        o->sc.slots[idx].state = SLOT_FREE;
+        return -1;
+    }
     return 0;
 }
 
-/* place this function in drm_simple.c after the other helpers */
+int drm_frame_begin(uint32_t output, struct backend_frame *f, const struct region *damage) {
+    struct drm_output *o = find_output(output);
+    if (!o) return -1;
+    int back = swapchain_acquire(&o->sc);
+    if (back < 0) return 1;
 
-/* Copy client SHM pixels (assumed XRGB8888 / ARGB8888 little-endian) into back buffer and pageflip.
- * This reuses the pageflip logic already present in this file.
- */
-int drm_present_from_shm(const void *src, uint32_t src_stride, uint32_t width, uint32_t height) {
-    if (!S.map[0] || !S.map[1]) return -1;
-
-    int back = S.front_buf ^ 1;
-    uint32_t dst_pitch = S.pitch[back];
-    uint8_t *dst = S.map[back];
-    const uint8_t *s = src;
+    struct drm_slot *sl = &o->slots[back];
+    f->width = o->mode.hdisplay;
+    f->height = o->mode.vdisplay;
+    f->slot = back;
+    f->noverlays = 0;
+    region_init(&f->damage);
+    if (damage && !o->composite_stale) region_union(&f->damage, damage);
+    else region_add(&f->damage, 0, 0, f->width, f->height);
+    region_clip(&f->damage, f->width, f->height);
 
-    /* Clip width/height to mode for safety */
-    if (width > S.mode.hdisplay) width = S.mode.hdisplay;
-    if (height > S.mode.vdisplay) height = S.mode.vdisplay;
+    if (o->shadow) {
+        /* the shadow always holds the previous frame, so only this
+         * frame's damage needs drawing */
+        f->map = o->shadow;
+        f->pitch = o->shadow_pitch;
+        f->write_combined = 0;
+        f->repaint = f->damage;
+    } else {
+        f->map = sl->map;
+        f->pitch = sl->pitch;
+        f->write_combined = 1;
+        swapchain_repaint_region(&o->sc, back, &f->damage, f->width, f->height, &f->repaint);
+    }
+    return 0;
+}
 
-    for (uint32_t y = 0; y < height; ++y) {
-        memcpy(dst + y * dst_pitch, s + y * src_stride, width * 4);
+int drm_frame_submit(uint32_t output, struct backend_frame *f) {
+    struct drm_output *o = find_output(output);
+    if (!o) return -1;
+    if (o->shadow) {
+        struct region upload;
+        swapchain_repaint_region(&o->sc, f->slot, &f->damage, o->mode.hdisplay, o->mode.vdisplay, &upload);
+        shadow_upload(o, f->slot, &upload);
     }
+    /* order any streaming stores before the flip */
+    stream_fence();
+    swapchain_drawn(&o->sc, f->slot, &f->damage, o->mode.hdisplay, o->mode.vdisplay);
+    struct drm_slot *sl = &o->slots[f->slot];
+    sl->noverlays = f->noverlays < o->atomic.noverlays ? f->noverlays : o->atomic.noverlays;
+    memcpy(sl->overlays, f->overlays, sizeof(sl->overlays[0]) * (size_t)sl->noverlays);
+    o->composite_stale = 0;
+    drop_ready(o, f->slot);
+    return submit_slot(o, f->slot);
+}
 
-    /* If this is the first time, setcrtc to back buffer synchronously */
-    if (!S.crtc || S.crtc->buffer_id == 0) {
-        int ret = drmModeSetCrtc(S.fd, S.crtc_id, S.fb_id[back], 0, 0,
-                                 &S.connector_id, 1, &S.mode);
-        if (ret) {
-            perror("drmModeSetCrtc initial");
-            return -1;
+int drm_frame_scanout(uint32_t output, uint32_t fb_id) {
+    struct drm_output *o = find_output(output);
+    if (!o || !fb_id || !o->atomic.enabled || !o->mode_set) return -1;
+    /* the plane may not take the format, stride or memory of the buffer */
+    if (atomic_commit(o, fb_id, NULL, 0, DRM_MODE_ATOMIC_TEST_ONLY, NULL) != 0) return -1;
+
+    int idx = -1;
+    for (int i = SWAPCHAIN_MAX_SLOTS; i < SWAPCHAIN_ALL_SLOTS; ++i) {
+        if (o->sc.slots[i].state == SLOT_READY) {
+            idx = i;
+            break;
         }
-        S.front_buf = back;
-        return 0;
+        if (o->sc.slots[i].state == SLOT_FREE && idx < 0) idx = i;
     }
+    if (idx < 0) return -1;
 
-    /* Schedule pageflip to back buffer with event handler */
-    struct pageflip_cookie *cookie = malloc(sizeof(*cookie));
-    if (!cookie) return -1;
-    cookie->s = &S;
-    cookie->which = back;
-    int ret = drmModePageFlip(S.fd, S.crtc_id, S.fb_id[back], DRM_MODE_PAGE_FLIP_EVENT, cookie);
-    if (ret) {
-        perror("drmModePageFlip");
-        free(cookie);
+    o->slots[idx].fb_id = fb_id;
+    o->slots[idx].noverlays = 0;
+    o->sc.slots[idx].seq = ++o->sc.frame_seq;
+    o->composite_stale = 1;
+    drop_ready(o, idx);
+    return submit_slot(o, idx);
+}
+
+int drm_overlay_test(uint32_t output, const struct backend_overlay *overlays, int n) {
+    struct drm_output *o = find_output(output);
+    if (!o) return -1;
+    if (n == 0) return 0;
+    if (!o->atomic.enabled || !o->mode_set || n > o->atomic.noverlays) return -1;
+    /* over the slot the next frame will be drawn into; they all share a
+     * layout, so any will do if none is free now */
+    int idx = swapchain_acquire(&o->sc);
+    if (idx < 0) idx = 0;
+    return atomic_commit(o, o->slots[idx].fb_id, overlays, n, DRM_MODE_ATOMIC_TEST_ONLY, NULL) == 0 ? 0 : -1;
+}
+
+int drm_get_fd(void) {
+    return S.epoll_fd;
+}
+
+int drm_can_present(uint32_t output) {
+    const struct drm_output *o = find_output(output);
+    if (!o) return -1;
+    return swapchain_acquire(&o->sc) >= 0;
+}
+
+uint64_t drm_present_seq(uint32_t output) {
+    const struct drm_output *o = find_output(output);
+    return o ? o->sc.frame_seq : 0;
+}
+
+uint64_t drm_refresh_ns(uint32_t output) {
+    const struct drm_output *o = find_output(output);
+    return o ? o->refresh_ns : 0;
+}
+
+uint64_t drm_scanout_seq(uint32_t output) {
+    const struct drm_output *o = find_output(output);
+    return o ? o->scanout_seq : 0;
+}
+
+void drm_set_flip_done_handler(backend_flip_done_fn fn, void *data) {
+    S.flip_done = fn;
+    S.flip_done_data = data;
+}
+
+void drm_set_output_handler(backend_output_fn fn, void *data) {
+    S.output_fn = fn;
+    S.output_data = data;
+    if (!fn) return;
+    for (int i = 0; i < S.noutputs; ++i) {
+        if (S.outputs[i]->gone) continue;
+        struct backend_output_info info;
+        output_info(S.outputs[i], &info);
+        fn(1, &info, data);
+    }
+}
+
+/* Read and handle pending DRM and hotplug events; call when the fd from
+ * drm_get_fd() is readable */
+int drm_dispatch(void) {
+    struct epoll_event evs[2];
+    int n = epoll_wait(S.epoll_fd, evs, 2, 0);
+    if (n < 0) {
+        if (errno == EINTR) return 0;
+        perror("DRM: epoll_wait");
         return -1;
     }
-    S.pending_flip = 1;
+    for (int i = 0; i < n; ++i) {
+        if (evs[i].data.fd == S.fd) {
+            drmEventContext evctx = {
+                .version = DRM_EVENT_CONTEXT_VERSION,
+                .page_flip_handler = page_flip_handler
+            };
+            if (drmHandleEvent(S.fd, &evctx) != 0) {
+                perror("drmHandleEvent");
+                return -1;
+            }
+        } else if (S.monitor) {
+            handle_uevent();
+        }
+    }
+    return 0;
+}
 
-    /* process events until flip completes */
-    while (S.pending_flip) {
-        int w = wait_for_vblank_completion(5000);
-        if (w < 0) return -1;
-        if (w == 1) {
-            fprintf(stderr, "Timeout waiting for pageflip\n");
-            return -1;
+dev_t drm_device(void) {
+    return S.devnum;
+}
+
+int drm_import_dmabuf(const struct backend_dmabuf *buf, uint32_t *fb_id) {
+    if (!S.prime_import || buf->nplanes < 1 || buf->nplanes > BACKEND_DMABUF_MAX_PLANES) return -1;
+    int explicit_mod = buf->modifier != DRM_FORMAT_MOD_INVALID;
+    if (explicit_mod && !S.fb_modifiers) return -1;
+
+    uint32_t handles[4] = {0}, pitches[4] = {0}, offsets[4] = {0};
+    uint64_t modifiers[4] = {0};
+    int ret = -1;
+
+    pthread_mutex_lock(&import_lock);
+    int i;
+    for (i = 0; i < buf->nplanes; ++i) {
+        if (drmPrimeFDToHandle(S.fd, buf->fd[i], &handles[i]) != 0) {
+            perror("drmPrimeFDToHandle");
+            goto out;
         }
+        pitches[i] = buf->stride[i];
+        offsets[i] = buf->offset[i];
+        modifiers[i] = buf->modifier;
     }
+    if (explicit_mod)
+        ret = drmModeAddFB2WithModifiers(S.fd, (uint32_t)buf->width, (uint32_t)buf->height, buf->format, handles,
+                                         pitches, offsets, modifiers, fb_id, DRM_MODE_FB_MODIFIERS);
+    else
+        ret = drmModeAddFB2(S.fd, (uint32_t)buf->width, (uint32_t)buf->height, buf->format, handles, pitches,
+                            offsets, fb_id, 0);
+    ret = ret ? -1 : 0;
 
-    return 0;
+out:
+    /* the framebuffer holds its own references to the buffer objects;
+     * planes may share a handle, which is closed once */
+    for (int j = 0; j < i; ++j) {
+        int dup = 0;
+        for (int k = 0; k < j && !dup; ++k) dup = handles[k] == handles[j];
+        if (!dup) drmCloseBufferHandle(S.fd, handles[j]);
+    }
+    pthread_mutex_unlock(&import_lock);
+    return ret;
+}
+
+void drm_release_dmabuf(uint32_t fb_id) {
+    if (fb_id && S.fd >= 0) drmModeRmFB(S.fd, fb_id);
 }
+
+const struct backend drm_backend = {
+    .name = "drm",
+    .setup = drm_setup,
+    .teardown = drm_teardown,
+    .frame_begin = drm_frame_begin,
+    .frame_submit = drm_frame_submit,
+    .frame_scanout = drm_frame_scanout,
+    .overlay_test = drm_overlay_test,
+    .get_fd = drm_get_fd,
+    .dispatch = drm_dispatch,
+    .can_present = drm_can_present,
+    .present_seq = drm_present_seq,
+    .scanout_seq = drm_scanout_seq,
+    .refresh_ns = drm_refresh_ns,
+    .set_flip_done_handler = drm_set_flip_done_handler,
+    .set_output_handler = drm_set_output_handler,
+    .cursor_set_image = drm_cursor_set_image,
+    .cursor_move = drm_cursor_move,
+    .device = drm_device,
+    .import_dmabuf = drm_import_dmabuf,
+    .release_dmabuf = drm_release_dmabuf,
+};
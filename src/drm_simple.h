@@ -3,19 +3,64 @@
 
 #include <stdint.h>
 
-/* existing API */
-int drm_setup(void);
-void drm_teardown(void);
-int drm_present_solid(uint32_t r, uint32_t g, uint32_t b);
+#include "backend.h"
 
-/* new: copy a client-provided ARGB8888 buffer into the back buffer and pageflip.
- * src: pointer to client data (in client bytes per row src_stride)
- * src_stride: bytes per row in the source (client stride)
- * width: width in pixels to copy (should match mode.hdisplay)
- * height: height in pixels to copy
+/* KMS backend (drm_backend); see backend.h for the interface.
+ *
+ * The device is the seat0 KMS card with a connected connector (boot VGA
+ * first), found with udev, or ARGUS_DRM_DEVICE. Every connected connector
+ * becomes an output on its own CRTC with its preferred mode; connectors
+ * plugged or unplugged later are picked up from udev hotplug events, which
+ * arrive on the same fd as flip completions.
  *
- * returns 0 on success.
+ * By default frames are drawn into a cacheable shadow framebuffer holding
+ * the previous frame, so repaint is just the frame's damage (NULL = whole
+ * output); on submit the slot is brought up to date from the shadow,
+ * damage widened by the slot's age, with streaming stores. With
+ * ARGUS_SHADOW=0 the caller draws straight into the write-combined slot
+ * and repaint includes the age widening.
+ *
+ * Frames are committed with atomic KMS (nonblocking, including the initial
+ * modeset) when the driver supports it, and with legacy SetCrtc/PageFlip
+ * otherwise or when ARGUS_LEGACY_KMS is set.
+ * Each output scans out of a swapchain of 2-4 dumb buffers (ARGUS_SWAPCHAIN,
+ * default 3).
  */
-int drm_present_from_shm(const void *src, uint32_t src_stride, uint32_t width, uint32_t height);
+int drm_setup(void);
+void drm_teardown(void);
+
+int drm_frame_begin(uint32_t output, struct backend_frame *f, const struct region *damage);
+int drm_frame_submit(uint32_t output, struct backend_frame *f);
+/* Client framebuffers go straight onto the primary plane, with atomic KMS
+ * only and once the CRTC is lit, if a TEST_ONLY commit accepts them */
+int drm_frame_scanout(uint32_t output, uint32_t fb_id);
+/* Each atomic output claims up to BACKEND_MAX_OVERLAYS overlay planes its
+ * CRTC can use and no other output has, stacked by zpos; overlays are
+ * tested with a TEST_ONLY commit and flipped together with the frame */
+int drm_overlay_test(uint32_t output, const struct backend_overlay *overlays, int n);
+
+int drm_get_fd(void);
+int drm_dispatch(void);
+int drm_can_present(uint32_t output);
+uint64_t drm_present_seq(uint32_t output);
+uint64_t drm_scanout_seq(uint32_t output);
+void drm_set_flip_done_handler(backend_flip_done_fn fn, void *data);
+void drm_set_output_handler(backend_output_fn fn, void *data);
+
+/* Refresh period in ns, measured from flip timestamps (the mode's nominal
+ * period until two flips have landed) */
+uint64_t drm_refresh_ns(uint32_t output);
+
+/* Hardware cursor planes; the image is clipped to the plane size */
+int drm_cursor_set_image(const void *argb, uint32_t stride, uint32_t width, uint32_t height,
+                         int32_t hot_x, int32_t hot_y);
+int drm_cursor_move(uint32_t output, int32_t x, int32_t y);
+
+/* dmabuf import with drmPrimeFDToHandle and AddFB2(WithModifiers); fails
+ * without PRIME import support or, for explicit modifiers, without
+ * DRM_CAP_ADDFB2_MODIFIERS */
+dev_t drm_device(void);
+int drm_import_dmabuf(const struct backend_dmabuf *buf, uint32_t *fb_id);
+void drm_release_dmabuf(uint32_t fb_id);
 
 #endif
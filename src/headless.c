@@ -0,0 +1,434 @@
+#define _GNU_SOURCE
+#include "backend.h"
+#include "swapchain.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Headless backend: swapchains live in ordinary memory and vblanks are
+ * synthesized from a timerfd per output on a fixed grid, so the compositor
+ * runs (and can be benchmarked) without a display.
+ *
+ * ARGUS_HEADLESS_OUTPUTS sets the number of outputs (default 1),
+ * ARGUS_HEADLESS_SIZE=WxH their size (default 1920x1080),
+ * ARGUS_HEADLESS_REFRESH the refresh rate in Hz (default 60; a list such as
+ * "60,144" gives the outputs different rates), and ARGUS_HEADLESS_DUMP a
+ * directory into which every frame that reaches the "screen" is written as
+ * a PPM. ARGUS_SWAPCHAIN is honoured as for DRM.
+ *
+ * A timer is only armed while a flip is queued, so an idle output causes
+ * no wakeups; vblank counters and timestamps follow from the grid, as if
+ * the display had been running since setup. The timers share one epoll fd,
+ * which is what get_fd() returns.
+ */
+
+/* Buffer of a swapchain slot */
+struct hl_slot {
+    uint8_t *map;
+};
+
+struct hl_output {
+    uint32_t id;
+    int timer_fd;
+    uint32_t refresh_mhz;
+    uint64_t refresh_ns;
+    uint64_t flip_vblank; /* vblank the queued flip lands on */
+
+    struct swapchain sc;
+    struct hl_slot slots[SWAPCHAIN_MAX_SLOTS]; /* buffers of sc's slots */
+    int pending_flip;
+
+    uint64_t scanout_seq;
+};
+
+static struct {
+    int epoll_fd;
+    uint32_t width, height, pitch;
+    size_t size;
+    uint64_t epoch_ns; /* vblank 0 of every output */
+    const char *dump_dir;
+
+    struct hl_output outputs[BACKEND_MAX_OUTPUTS];
+    int noutputs;
+
+    backend_flip_done_fn flip_done;
+    backend_output_fn output_fn;
+    void *flip_done_data, *output_data;
+} H = {.epoll_fd = -1};
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static struct hl_output *find_output(uint32_t id) {
+    for (int i = 0; i < H.noutputs; ++i) {
+        if (H.outputs[i].id == id) return &H.outputs[i];
+    }
+    return NULL;
+}
+
+/* Refresh rate in mHz of output i from ARGUS_HEADLESS_REFRESH; the last
+ * entry of a list applies to the outputs beyond it */
+static uint32_t output_refresh_mhz(int i) {
+    const char *env = getenv("ARGUS_HEADLESS_REFRESH");
+    double hz = 60.0;
+    while (env && *env) {
+        char *end;
+        double v = strtod(env, &end);
+        if (end == env) break;
+        if (v >= 1.0 && v <= 1000.0) hz = v;
+        else fprintf(stderr, "headless: ignoring refresh rate %g\n", v);
+        if (i-- == 0 || *end != ',') break;
+        env = end + 1;
+    }
+    return (uint32_t)(hz * 1000.0 + 0.5);
+}
+
+static void parse_env(void) {
+    H.width = 1920;
+    H.height = 1080;
+    const char *env = getenv("ARGUS_HEADLESS_SIZE");
+    if (env) {
+        unsigned w, h;
+        if (sscanf(env, "%ux%u", &w, &h) == 2 && w > 0 && h > 0 && w <= 16384 && h <= 16384) {
+            H.width = w;
+            H.height = h;
+        } else {
+            fprintf(stderr, "headless: ignoring ARGUS_HEADLESS_SIZE=%s\n", env);
+        }
+    }
+
+    env = getenv("ARGUS_HEADLESS_OUTPUTS");
+    H.noutputs = env ? atoi(env) : 1;
+    if (H.noutputs < 1) H.noutputs = 1;
+    if (H.noutputs > BACKEND_MAX_OUTPUTS) H.noutputs = BACKEND_MAX_OUTPUTS;
+
+    H.dump_dir = getenv("ARGUS_HEADLESS_DUMP");
+}
+
+static int output_init(struct hl_output *o, int index) {
+    *o = (struct hl_output){.id = (uint32_t)index + 1, .timer_fd = -1};
+    o->refresh_mhz = output_refresh_mhz(index);
+    o->refresh_ns = 1000000000000ull / o->refresh_mhz;
+    swapchain_init(&o->sc);
+
+    o->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (o->timer_fd < 0) {
+        perror("headless: timerfd_create");
+        return -1;
+    }
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = o};
+    if (epoll_ctl(H.epoll_fd, EPOLL_CTL_ADD, o->timer_fd, &ev) != 0) {
+        perror("headless: epoll_ctl");
+        return -1;
+    }
+
+    for (int i = 0; i < o->sc.nslots; ++i) {
+        void *p = mmap(NULL, H.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            perror("headless: swapchain mmap");
+            return -1;
+        }
+        madvise(p, H.size, MADV_HUGEPAGE);
+        o->slots[i].map = p;
+    }
+    return 0;
+}
+
+static void output_fini(struct hl_output *o) {
+    for (int i = 0; i < SWAPCHAIN_MAX_SLOTS; ++i) {
+        if (o->slots[i].map) munmap(o->slots[i].map, H.size);
+        o->slots[i] = (struct hl_slot){0};
+    }
+    if (o->timer_fd >= 0) close(o->timer_fd);
+    o->timer_fd = -1;
+}
+
+static void headless_teardown(void);
+
+static int headless_setup(void) {
+    parse_env();
+
+    H.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (H.epoll_fd < 0) {
+        perror("headless: epoll_create1");
+        return -1;
+    }
+
+    /* whole cache lines per row, as for the DRM shadow */
+    H.pitch = (H.width * 4 + 63) & ~63u;
+    H.size = (size_t)H.pitch * H.height;
+    int n = H.noutputs;
+    H.noutputs = 0;
+    for (int i = 0; i < n; ++i) {
+        /* counted first so teardown frees a half-initialized output */
+        H.noutputs++;
+        if (output_init(&H.outputs[i], i) != 0) {
+            headless_teardown();
+            return -1;
+        }
+    }
+    H.epoch_ns = monotonic_ns();
+
+    for (int i = 0; i < H.noutputs; ++i)
+        printf("headless: output %u %ux%u @ %u.%03u Hz, %d slots\n", H.outputs[i].id, H.width, H.height,
+               H.outputs[i].refresh_mhz / 1000, H.outputs[i].refresh_mhz % 1000, H.outputs[i].sc.nslots);
+    if (H.dump_dir) printf("headless: dumping frames to %s\n", H.dump_dir);
+    return 0;
+}
+
+static void headless_teardown(void) {
+    for (int i = 0; i < H.noutputs; ++i) output_fini(&H.outputs[i]);
+    H.noutputs = 0;
+    H.flip_done = NULL;
+    H.output_fn = NULL;
+    if (H.epoll_fd >= 0) close(H.epoll_fd);
+    H.epoll_fd = -1;
+}
+
+/* Write slot idx of o as a binary PPM named after the output and frame */
+static void dump_slot(const struct hl_output *o, int idx) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/output%u-frame%06llu.ppm", H.dump_dir, o->id,
+             (unsigned long long)o->sc.slots[idx].seq);
+    FILE *fp = fopen(path, "wb");
+    if (!fp) {
+        perror("headless: frame dump");
+        return;
+    }
+    uint8_t *row = malloc((size_t)H.width * 3);
+    if (row) {
+        fprintf(fp, "P6\n%u %u\n255\n", H.width, H.height);
+        for (uint32_t y = 0; y < H.height; ++y) {
+            const uint32_t *src = (const uint32_t *)(o->slots[idx].map + (size_t)y * H.pitch);
+            for (uint32_t x = 0; x < H.width; ++x) {
+                row[x * 3 + 0] = (uint8_t)(src[x] >> 16);
+                row[x * 3 + 1] = (uint8_t)(src[x] >> 8);
+                row[x * 3 + 2] = (uint8_t)src[x];
+            }
+            fwrite(row, 3, H.width, fp);
+        }
+        free(row);
+    }
+    if (fclose(fp) != 0) perror("headless: frame dump");
+}
+
+/* Queue slot idx for the output's next vblank on the grid */
+static int queue_flip(struct hl_output *o, int idx) {
+    uint64_t now = monotonic_ns();
+    o->flip_vblank = (now - H.epoch_ns) / o->refresh_ns + 1;
+    uint64_t at = H.epoch_ns + o->flip_vblank * o->refresh_ns;
+    struct itimerspec its = {
+        .it_value = {.tv_sec = (time_t)(at / 1000000000u), .tv_nsec = (long)(at % 1000000000u)},
+    };
+    if (timerfd_settime(o->timer_fd, TFD_TIMER_ABSTIME, &its, NULL) != 0) {
+        perror("headless: timerfd_settime");
+        return -1;
+    }
+    o->sc.slots[idx].state = SLOT_QUEUED;
+    o->pending_flip = 1;
+    return 0;
+}
+
+/* The vblank a queued flip waited for has come */
+static void flip_landed(struct hl_output *o) {
+    uint64_t expirations;
+    if (read(o->timer_fd, &expirations, sizeof(expirations)) < 0) {
+        if (errno != EAGAIN) perror("headless: timerfd read");
+        return;
+    }
+    if (!o->pending_flip) return;
+
+    int which = -1;
+    for (int i = 0; i < o->sc.nslots; ++i) {
+        if (o->sc.slots[i].state == SLOT_SCANOUT) o->sc.slots[i].state = SLOT_FREE;
+        else if (o->sc.slots[i].state == SLOT_QUEUED) which = i;
+    }
+    if (which < 0) return;
+    o->sc.slots[which].state = SLOT_SCANOUT;
+    o->scanout_seq = o->sc.slots[which].seq;
+    o->pending_flip = 0;
+    if (H.dump_dir) dump_slot(o, which);
+
+    /* the vblank the flip was queued for, even if this thread woke late */
+    unsigned int frame = (unsigned int)o->flip_vblank;
+    uint64_t t = H.epoch_ns + o->flip_vblank * o->refresh_ns;
+
+    for (int i = 0; i < o->sc.nslots; ++i) {
+        if (o->sc.slots[i].state == SLOT_READY) {
+            if (queue_flip(o, i) != 0) o->sc.slots[i].state = SLOT_FREE;
+            break;
+        }
+    }
+
+    if (H.flip_done)
+        H.flip_done(o->id, frame, (unsigned int)(t / 1000000000u), (unsigned int)(t % 1000000000u / 1000u),
+                    H.flip_done_data);
+}
+
+static int headless_dispatch(void) {
+    struct epoll_event evs[BACKEND_MAX_OUTPUTS];
+    int n = epoll_wait(H.epoll_fd, evs, BACKEND_MAX_OUTPUTS, 0);
+    if (n < 0) {
+        if (errno == EINTR) return 0;
+        perror("headless: epoll_wait");
+        return -1;
+    }
+    for (int i = 0; i < n; ++i) flip_landed(evs[i].data.ptr);
+    return 0;
+}
+
+static int headless_frame_begin(uint32_t output, struct backend_frame *f, const struct region *damage) {
+    struct hl_output *o = find_output(output);
+    if (!o) return -1;
+    int back = swapchain_acquire(&o->sc);
+    if (back < 0) return 1;
+
+    f->map = o->slots[back].map;
+    f->pitch = H.pitch;
+    f->write_combined = 0;
+    f->width = H.width;
+    f->height = H.height;
+    f->slot = back;
+    f->noverlays = 0;
+    region_init(&f->damage);
+    if (damage) region_union(&f->damage, damage);
+    else region_add(&f->damage, 0, 0, f->width, f->height);
+    region_clip(&f->damage, f->width, f->height);
+
+    swapchain_repaint_region(&o->sc, back, &f->damage, (int32_t)f->width, (int32_t)f->height, &f->repaint);
+    return 0;
+}
+
+static int headless_frame_submit(uint32_t output, struct backend_frame *f) {
+    struct hl_output *o = find_output(output);
+    if (!o) return -1;
+    int idx = f->slot;
+    swapchain_drawn(&o->sc, idx, &f->damage, (int32_t)H.width, (int32_t)H.height);
+
+    if (o->pending_flip) {
+        o->sc.slots[idx].state = SLOT_READY;
+        return 0;
+    }
+    if (queue_flip(o, idx) != 0) {
+        o->sc.slots[idx].state = SLOT_FREE;
+        return -1;
+    }
+    return 0;
+}
+
+static int headless_get_fd(void) {
+    return H.epoll_fd;
+}
+
+static int headless_can_present(uint32_t output) {
+    const struct hl_output *o = find_output(output);
+    if (!o) return -1;
+    return swapchain_acquire(&o->sc) >= 0;
+}
+
+static uint64_t headless_present_seq(uint32_t output) {
+    const struct hl_output *o = find_output(output);
+    return o ? o->sc.frame_seq : 0;
+}
+
+static uint64_t headless_scanout_seq(uint32_t output) {
+    const struct hl_output *o = find_output(output);
+    return o ? o->scanout_seq : 0;
+}
+
+static uint64_t headless_refresh_ns(uint32_t output) {
+    const struct hl_output *o = find_output(output);
+    return o ? o->refresh_ns : 0;
+}
+
+static void headless_set_flip_done_handler(backend_flip_done_fn fn, void *data) {
+    H.flip_done = fn;
+    H.flip_done_data = data;
+}
+
+/* Outputs never change, so they are only announced here */
+static void headless_set_output_handler(backend_output_fn fn, void *data) {
+    H.output_fn = fn;
+    H.output_data = data;
+    if (!fn) return;
+    for (int i = 0; i < H.noutputs; ++i) {
+        struct backend_output_info info = {
+            .id = H.outputs[i].id,
+            .width = H.width,
+            .height = H.height,
+            .refresh_mhz = H.outputs[i].refresh_mhz,
+        };
+        snprintf(info.name, sizeof(info.name), "HEADLESS-%u", H.outputs[i].id);
+        fn(1, &info, data);
+    }
+}
+
+/* No cursor plane: the pointer is simply not drawn */
+static int headless_cursor_set_image(const void *argb, uint32_t stride, uint32_t width, uint32_t height,
+                                     int32_t hot_x, int32_t hot_y) {
+    (void)argb; (void)stride; (void)width; (void)height; (void)hot_x; (void)hot_y;
+    return -1;
+}
+
+static int headless_cursor_move(uint32_t output, int32_t x, int32_t y) {
+    (void)output; (void)x; (void)y;
+    return -1;
+}
+
+/* Nothing is scanned out: every frame is drawn, and there are no overlay
+ * planes */
+static int headless_frame_scanout(uint32_t output, uint32_t fb_id) {
+    (void)output; (void)fb_id;
+    return -1;
+}
+
+static int headless_overlay_test(uint32_t output, const struct backend_overlay *overlays, int n) {
+    (void)output; (void)overlays;
+    return n == 0 ? 0 : -1;
+}
+
+/* No device: dmabufs are only ever read through the CPU */
+static dev_t headless_device(void) {
+    return 0;
+}
+
+static int headless_import_dmabuf(const struct backend_dmabuf *buf, uint32_t *fb_id) {
+    (void)buf; (void)fb_id;
+    return -1;
+}
+
+static void headless_release_dmabuf(uint32_t fb_id) {
+    (void)fb_id;
+}
+
+const struct backend headless_backend = {
+    .name = "headless",
+    .setup = headless_setup,
+    .teardown = headless_teardown,
+    .frame_begin = headless_frame_begin,
+    .frame_submit = headless_frame_submit,
+    .frame_scanout = headless_frame_scanout,
+    .overlay_test = headless_overlay_test,
+    .get_fd = headless_get_fd,
+    .dispatch = headless_dispatch,
+    .can_present = headless_can_present,
+    .present_seq = headless_present_seq,
+    .scanout_seq = headless_scanout_seq,
+    .refresh_ns = headless_refresh_ns,
+    .set_flip_done_handler = headless_set_flip_done_handler,
+    .set_output_handler = headless_set_output_handler,
+    .cursor_set_image = headless_cursor_set_image,
+    .cursor_move = headless_cursor_move,
+    .device = headless_device,
+    .import_dmabuf = headless_import_dmabuf,
+    .release_dmabuf = headless_release_dmabuf,
+};
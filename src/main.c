@@ -2,102 +2,105 @@
 #include <stdlib.h>
 #include <signal.h>
 #include <unistd.h>
-#include <poll.h>
 
-#include "drm_simple.h"
+#include <wayland-server-core.h>
+
+#include "blend.h"
+#include "convert.h"
+#include "backend.h"
 #include "wayland.h"
 #include "input.h"
+#include "stream.h"
+#include "workers.h"
 
 static volatile int running = 1;
 
-static void handle_sigint(int sig) {
-    (void)sig;
+/* SIGINT/SIGTERM, delivered through the event loop's signalfd */
+static int handle_signal(int sig, void *data) {
+    (void)sig; (void)data;
     running = 0;
+    return 0;
+}
+
+/* libinput fd readable: process input right away */
+static int handle_input(int fd, uint32_t mask, void *data) {
+    (void)fd; (void)data;
+    if (mask & (WL_EVENT_HANGUP | WL_EVENT_ERROR)) {
+        fprintf(stderr, "libinput fd error\n");
+        return 0;
+    }
+    if (input_dispatch() != 0)
+        fprintf(stderr, "input_dispatch error\n");
+    return 0;
 }
 
 int main(int argc, char **argv) {
     (void)argc; (void)argv;
-    signal(SIGINT, handle_sigint);
 
-    printf("Argus starting: Wayland + DRM + Input integration test\n");
+    printf("Argus starting: Wayland + KMS/headless + Input integration test\n");
+
+    blend_init();
+    convert_init();
+    stream_init();
 
-    if (drm_setup() != 0) {
-        fprintf(stderr, "drm_setup failed\n");
+    if (backend_init() != 0) {
+        fprintf(stderr, "no usable output backend\n");
         return 1;
     }
 
+    /* the render thread submits composition jobs as soon as it starts */
+    workers_init(0);
+
+    /* Each output is lit by its first repaint once the render thread
+     * announces it; after that frames are only produced when a client
+     * commits, so an idle screen causes no wakeups at all. */
     if (wl_init_server() != 0) {
         fprintf(stderr, "Wayland server init failed\n");
-        drm_teardown();
+        workers_fini();
+        backend_fini();
         return 1;
     }
 
+    struct wl_event_loop *loop = wl_get_event_loop();
+    struct wl_event_source *sigint_source = wl_event_loop_add_signal(loop, SIGINT, handle_signal, NULL);
+    struct wl_event_source *sigterm_source = wl_event_loop_add_signal(loop, SIGTERM, handle_signal, NULL);
+    struct wl_event_source *input_source = NULL;
+
     if (input_init() != 0) {
         fprintf(stderr, "input_init failed (continuing without input)\n");
+    } else {
+        int ifd = input_get_fd();
+        if (ifd >= 0)
+            input_source = wl_event_loop_add_fd(loop, ifd, WL_EVENT_READABLE, handle_input, NULL);
+        if (!input_source)
+            fprintf(stderr, "failed to watch libinput fd (continuing without input)\n");
+        /* drain device-added events queued by seat assignment */
+        input_dispatch();
     }
 
-    /* Colors to pageflip through */
-    uint32_t colors[][3] = {
-        {0xff, 0x00, 0x00}, /* red */
-        {0x00, 0xff, 0x00}, /* green */
-        {0x00, 0x80, 0xff}, /* blue-ish */
-        {0xff, 0xff, 0xff}, /* white */
-    };
-
-    int idx = 0;
-
     while (running) {
-        /* Process Wayland events (non-blocking up to 10 ms) */
-        if (wl_run_iteration(10) != 0) {
+        /* Block until a client, input, render thread or signal source is ready */
+        if (wl_run_iteration(-1) != 0) {
             fprintf(stderr, "Wayland iteration failed\n");
             break;
         }
+    }
 
-        /* Process libinput if available */
-        int ifd = input_get_fd();
-        if (ifd >= 0) {
-            struct pollfd pfd = { .fd = ifd, .events = POLLIN };
-            int pret = poll(&pfd, 1, 0);
-            if (pret > 0) {
-                if (input_dispatch() != 0) {
-                    fprintf(stderr, "input_dispatch error\n");
-                }
-            }
-        }
+    if (input_source) wl_event_source_remove(input_source);
+    if (sigterm_source) wl_event_source_remove(sigterm_source);
+    if (sigint_source) wl_event_source_remove(sigint_source);
 
-        /* Present next color (blocking until pageflip completes) */
-        uint32_t *c = colors[idx % (sizeof(colors)/sizeof(colors[0]))];
-        if (drm_present_solid(c[0], c[1], c[2]) != 0) {
-            fprintf(stderr, "drm_present_solid failed\n");
-            break;
-        }
-        idx++;
-
-        /* Sleep in small steps while still dispatching Wayland to keep clients responsive.
-         * Sleep total 2000ms split into 100ms chunks and dispatch events.
-         */
-        int loops = 20;
-        for (int i = 0; i < loops && running; ++i) {
-            if (wl_run_iteration(100) != 0) {
-                running = 0;
-                break;
-            }
-            if (ifd >= 0) {
-                struct pollfd pfd = { .fd = ifd, .events = POLLIN };
-                int pret = poll(&pfd, 1, 0);
-                if (pret > 0) {
-                    if (input_dispatch() != 0) {
-                        running = 0;
-                        break;
-                    }
-                }
-            }
-        }
-    }
+    struct repaint_stats rs;
+    wl_get_repaint_stats(&rs);
+    printf("repaint: %llu frames (%llu scanned out directly, %llu overlay plane uses), %llu missed vblanks, "
+           "%llu late starts, budget %llu us\n",
+           (unsigned long long)rs.frames, (unsigned long long)rs.bypassed, (unsigned long long)rs.overlaid,
+           (unsigned long long)rs.missed, (unsigned long long)rs.late, (unsigned long long)(rs.budget_ns / 1000));
 
     input_fini();
     wl_fini_server();
-    drm_teardown();
+    workers_fini();
+    backend_fini();
     printf("Argus exiting\n");
     return 0;
 }
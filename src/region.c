@@ -0,0 +1,121 @@
+#include "region.h"
+
+#include <stddef.h>
+
+static int64_t rect_area(const struct rect *r) {
+    return (int64_t)(r->x2 - r->x1) * (int64_t)(r->y2 - r->y1);
+}
+
+static int rect_contains(const struct rect *outer, const struct rect *inner) {
+    return outer->x1 <= inner->x1 && outer->y1 <= inner->y1 &&
+           outer->x2 >= inner->x2 && outer->y2 >= inner->y2;
+}
+
+static struct rect rect_bounds(const struct rect *a, const struct rect *b) {
+    struct rect u = {
+        .x1 = a->x1 < b->x1 ? a->x1 : b->x1,
+        .y1 = a->y1 < b->y1 ? a->y1 : b->y1,
+        .x2 = a->x2 > b->x2 ? a->x2 : b->x2,
+        .y2 = a->y2 > b->y2 ? a->y2 : b->y2,
+    };
+    return u;
+}
+
+void region_init(struct region *rg) {
+    rg->n = 0;
+}
+
+int region_is_empty(const struct region *rg) {
+    return rg->n == 0;
+}
+
+static void region_add_rect(struct region *rg, struct rect nr) {
+    if (nr.x2 <= nr.x1 || nr.y2 <= nr.y1) return;
+
+    /* drop if already covered; absorb anything the new rect covers */
+    for (int i = 0; i < rg->n; ++i) {
+        if (rect_contains(&rg->r[i], &nr)) return;
+    }
+    int j = 0;
+    for (int i = 0; i < rg->n; ++i) {
+        if (!rect_contains(&nr, &rg->r[i])) rg->r[j++] = rg->r[i];
+    }
+    rg->n = j;
+
+    if (rg->n < REGION_MAX_RECTS) {
+        rg->r[rg->n++] = nr;
+        return;
+    }
+
+    /* full: grow the rect whose bounding box with nr adds the least area */
+    int best = 0;
+    int64_t best_cost = INT64_MAX;
+    for (int i = 0; i < rg->n; ++i) {
+        struct rect u = rect_bounds(&rg->r[i], &nr);
+        int64_t cost = rect_area(&u) - rect_area(&rg->r[i]);
+        if (cost < best_cost) {
+            best_cost = cost;
+            best = i;
+        }
+    }
+    struct rect merged = rect_bounds(&rg->r[best], &nr);
+    rg->r[best] = rg->r[--rg->n];
+    region_add_rect(rg, merged);
+}
+
+void region_add(struct region *rg, int32_t x, int32_t y, int32_t w, int32_t h) {
+    if (w <= 0 || h <= 0) return;
+    /* saturate instead of overflowing on huge client-supplied sizes */
+    int64_t x2 = (int64_t)x + w;
+    int64_t y2 = (int64_t)y + h;
+    struct rect nr = {
+        .x1 = x,
+        .y1 = y,
+        .x2 = x2 > INT32_MAX ? INT32_MAX : (int32_t)x2,
+        .y2 = y2 > INT32_MAX ? INT32_MAX : (int32_t)y2,
+    };
+    region_add_rect(rg, nr);
+}
+
+void region_union(struct region *dst, const struct region *src) {
+    if (dst == src) return;
+    for (int i = 0; i < src->n; ++i) region_add_rect(dst, src->r[i]);
+}
+
+void region_clip(struct region *rg, int32_t w, int32_t h) {
+    int j = 0;
+    for (int i = 0; i < rg->n; ++i) {
+        struct rect r = rg->r[i];
+        if (r.x1 < 0) r.x1 = 0;
+        if (r.y1 < 0) r.y1 = 0;
+        if (r.x2 > w) r.x2 = w;
+        if (r.y2 > h) r.y2 = h;
+        if (r.x2 > r.x1 && r.y2 > r.y1) rg->r[j++] = r;
+    }
+    rg->n = j;
+}
+
+void region_translate(struct region *rg, int32_t dx, int32_t dy) {
+    for (int i = 0; i < rg->n; ++i) {
+        rg->r[i].x1 += dx;
+        rg->r[i].y1 += dy;
+        rg->r[i].x2 += dx;
+        rg->r[i].y2 += dy;
+    }
+}
+
+struct rect region_extents(const struct region *rg) {
+    struct rect e = {0, 0, 0, 0};
+    if (rg->n == 0) return e;
+    e = rg->r[0];
+    for (int i = 1; i < rg->n; ++i) e = rect_bounds(&e, &rg->r[i]);
+    return e;
+}
+
+int region_intersects(const struct region *rg, const struct rect *r) {
+    for (int i = 0; i < rg->n; ++i) {
+        const struct rect *a = &rg->r[i];
+        if (a->x1 < r->x2 && r->x1 < a->x2 && a->y1 < r->y2 && r->y1 < a->y2) return 1;
+    }
+    return 0;
+}
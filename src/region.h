@@ -0,0 +1,43 @@
+#ifndef ARGUS_REGION_H
+#define ARGUS_REGION_H
+
+#include <stdint.h>
+
+/* Small fixed-capacity set of rectangles used for damage tracking.
+ * Rectangles are half-open [x1,x2) x [y1,y2). When the set is full, a new
+ * rectangle is merged into the existing one it enlarges least, so the region
+ * may grow to cover a little more than was damaged but never less.
+ */
+#define REGION_MAX_RECTS 16
+
+struct rect {
+    int32_t x1, y1, x2, y2;
+};
+
+struct region {
+    int n;
+    struct rect r[REGION_MAX_RECTS];
+};
+
+void region_init(struct region *rg);
+int region_is_empty(const struct region *rg);
+
+/* Add the rectangle (x, y, w, h); empty rectangles are ignored */
+void region_add(struct region *rg, int32_t x, int32_t y, int32_t w, int32_t h);
+
+/* dst |= src */
+void region_union(struct region *dst, const struct region *src);
+
+/* Clip every rectangle to (0, 0, w, h), dropping those left empty */
+void region_clip(struct region *rg, int32_t w, int32_t h);
+
+/* Move every rectangle by (dx, dy) */
+void region_translate(struct region *rg, int32_t dx, int32_t dy);
+
+/* Bounding box of the region (all zero when empty) */
+struct rect region_extents(const struct region *rg);
+
+/* Whether any rectangle of the region overlaps r */
+int region_intersects(const struct region *rg, const struct rect *r);
+
+#endif
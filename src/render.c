@@ -0,0 +1,665 @@
+#define _GNU_SOURCE
+#include "render.h"
+#include "backend.h"
+#include "spsc.h"
+
+#include <errno.h>
+#include <linux/dma-buf.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#define FRAME_QUEUE 8
+#define EVENT_QUEUE 64
+#define OVERLAY_TESTED_FBS 4
+
+struct dead_store {
+    struct view_store *store;
+    uint64_t serial;
+};
+
+/* The overlay placement last found for an output's candidates, which are
+ * told apart by store, box and format (not framebuffer: clients cycle
+ * through buffers). The framebuffers each placed candidate passed a test
+ * with are remembered, so a cycle of known buffers is not tested again. */
+struct overlay_assignment {
+    uint32_t output; /* 0 for an unused entry */
+    int n;
+    struct {
+        const struct view_store *store;
+        struct rect box;
+        const struct pixel_format *fmt;
+        int placed;
+        uint32_t tested[OVERLAY_TESTED_FBS]; /* newest first, 0 if unused */
+    } c[BACKEND_MAX_OVERLAYS];
+};
+
+static struct {
+    pthread_t thread;
+    int running;
+    atomic_int quit;
+
+    struct spsc frames; /* protocol -> render: struct render_frame * */
+    struct spsc events; /* render -> protocol: struct render_event */
+    int render_wake; /* eventfd polled by the render thread */
+    int proto_wake; /* eventfd watched by the protocol event loop */
+    atomic_int backlog; /* events wait on the overflow list */
+    struct wl_event_source *proto_source;
+    render_event_fn fn;
+    void *fn_data;
+
+    /* render thread only */
+    /* Frames waiting for a free slot, at most one per output (a newer
+     * frame for the output takes over the older one's damage), with the
+     * serial they were popped under */
+    struct render_frame *parked[BACKEND_MAX_OUTPUTS];
+    uint64_t parked_serial[BACKEND_MAX_OUTPUTS];
+    int nparked;
+    uint64_t serial;
+    /* Stores of destroyed views, tagged with the serial of the frame that
+     * brought them; frames popped before it may still draw from them */
+    struct dead_store *dead;
+    int ndead, dead_cap;
+    struct tile_list tiles;
+    struct overlay_assignment assignments[BACKEND_MAX_OUTPUTS];
+    /* Events that found the queue full, oldest first. They move to the
+     * queue as the protocol thread drains it; those left when the thread
+     * exits are delivered by render_stop() */
+    struct render_event *overflow;
+    int noverflow, overflow_cap;
+} R = {.render_wake = -1, .proto_wake = -1};
+
+struct render_frame *render_frame_create(void) {
+    struct render_frame *f = calloc(1, sizeof(*f));
+    if (!f) return NULL;
+    region_init(&f->damage);
+    f->scanout_upload = -1;
+    return f;
+}
+
+void render_frame_destroy(struct render_frame *f) {
+    if (!f) return;
+    for (int i = 0; i < f->ndead; ++i) view_store_destroy(f->dead[i]);
+    scene_snapshot_fini(&f->snap);
+    free(f->uploads);
+    free(f->dead);
+    free(f);
+}
+
+struct render_upload *render_frame_add_upload(struct render_frame *f) {
+    if (f->nuploads == f->uploads_cap) {
+        int cap = f->uploads_cap ? f->uploads_cap * 2 : 8;
+        struct render_upload *u = realloc(f->uploads, (size_t)cap * sizeof(*u));
+        if (!u) return NULL;
+        f->uploads = u;
+        f->uploads_cap = cap;
+    }
+    struct render_upload *u = &f->uploads[f->nuploads++];
+    memset(u, 0, sizeof(*u));
+    u->sync_fd = -1;
+    return u;
+}
+
+int render_frame_add_dead(struct render_frame *f, struct view_store *store) {
+    if (f->ndead == f->dead_cap) {
+        int cap = f->dead_cap ? f->dead_cap * 2 : 8;
+        struct view_store **d = realloc(f->dead, (size_t)cap * sizeof(*d));
+        if (!d) return -1;
+        f->dead = d;
+        f->dead_cap = cap;
+    }
+    f->dead[f->ndead++] = store;
+    return 0;
+}
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static void wake(int fd) {
+    uint64_t one = 1;
+    if (write(fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        perror("render: eventfd write");
+}
+
+static void drain(int fd) {
+    uint64_t n;
+    if (read(fd, &n, sizeof(n)) < 0 && errno != EAGAIN)
+        perror("render: eventfd read");
+}
+
+/* Move what fits of the overflow list to the queue. Returns whether it
+ * moved anything. */
+static int flush_overflow(void) {
+    int i = 0;
+    while (i < R.noverflow && spsc_push(&R.events, &R.overflow[i]) == 0) ++i;
+    if (i == 0) return 0;
+    R.noverflow -= i;
+    memmove(R.overflow, &R.overflow[i], (size_t)R.noverflow * sizeof(R.overflow[0]));
+    if (R.noverflow == 0) atomic_store(&R.backlog, 0);
+    return 1;
+}
+
+/* Render thread side of the event queue. This thread never waits for the
+ * protocol thread: events that find the queue full go on the overflow
+ * list, in order, and the protocol thread wakes this one once it has
+ * drained the queue. */
+static void post_event(const struct render_event *ev) {
+    flush_overflow();
+    if (R.noverflow > 0 || spsc_push(&R.events, ev) != 0) {
+        if (R.noverflow == R.overflow_cap) {
+            int cap = R.overflow_cap ? R.overflow_cap * 2 : 16;
+            struct render_event *o = realloc(R.overflow, (size_t)cap * sizeof(*o));
+            if (!o) {
+                fprintf(stderr, "render: out of memory, dropping an event\n");
+                return;
+            }
+            R.overflow = o;
+            R.overflow_cap = cap;
+        }
+        R.overflow[R.noverflow++] = *ev;
+        /* set before the wake, so the protocol thread sees it */
+        atomic_store(&R.backlog, 1);
+    }
+    wake(R.proto_wake);
+}
+
+static void flip_done(uint32_t output, unsigned int frame, unsigned int sec, unsigned int usec, void *data) {
+    (void)data;
+    struct render_event ev = {
+        .type = RENDER_EVENT_FLIP,
+        .output = output,
+        .scanout_seq = backend->scanout_seq(output),
+        .vblank = frame,
+        .sec = sec,
+        .usec = usec,
+        .refresh_ns = backend->refresh_ns(output),
+    };
+    post_event(&ev);
+}
+
+static struct render_event done_event(struct render_frame *f) {
+    struct render_event ev = {
+        .type = RENDER_EVENT_DONE,
+        .output = f->output,
+        .frame = f,
+        .present_seq = backend->present_seq(f->output),
+        .done_ns = monotonic_ns(),
+        .scanout_seq = backend->scanout_seq(f->output),
+    };
+    return ev;
+}
+
+/* Hand f back to the protocol thread, drawn or not */
+static void frame_done(struct render_frame *f) {
+    struct render_event ev = done_event(f);
+    post_event(&ev);
+}
+
+static void unpark(int i) {
+    R.parked[i] = R.parked[--R.nparked];
+    R.parked_serial[i] = R.parked_serial[R.nparked];
+}
+
+static void output_changed(int added, const struct backend_output_info *info, void *data) {
+    (void)data;
+    struct render_event ev = {
+        .type = added ? RENDER_EVENT_OUTPUT_ADDED : RENDER_EVENT_OUTPUT_REMOVED,
+        .output = info->id,
+        .info = *info,
+    };
+    post_event(&ev);
+    if (added) return;
+    for (int i = 0; i < BACKEND_MAX_OUTPUTS; ++i) {
+        if (R.assignments[i].output == info->id) R.assignments[i].output = 0;
+    }
+    for (int i = 0; i < R.nparked; ++i) {
+        if (R.parked[i]->output != info->id) continue;
+        struct render_frame *f = R.parked[i];
+        unpark(i);
+        frame_done(f);
+        break;
+    }
+}
+
+/* Make a dmabuf's contents coherent for CPU reads (START) or end them */
+static void dmabuf_sync(int fd, uint64_t flags) {
+    if (fd < 0) return;
+    struct dma_buf_sync sync = {.flags = flags | DMA_BUF_SYNC_READ};
+    while (ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync) != 0) {
+        if (errno == EINTR || errno == EAGAIN) continue;
+        perror("render: DMA_BUF_IOCTL_SYNC");
+        break;
+    }
+}
+
+static void apply_upload(const struct render_upload *u) {
+    if (!u->store) return;
+    dmabuf_sync(u->sync_fd, DMA_BUF_SYNC_START);
+    if (view_store_upload(u->store, u->data, u->stride, u->width, u->height, u->fmt, &u->damage) != 0)
+        fprintf(stderr, "render: out of memory for a %ux%u view\n", u->width, u->height);
+    dmabuf_sync(u->sync_fd, DMA_BUF_SYNC_END);
+}
+
+/* A newer upload into store has been applied: a parked frame's fallback
+ * upload into it would now go back in time, so it is dropped */
+static void cancel_deferred_uploads(const struct view_store *store) {
+    for (int i = 0; i < R.nparked; ++i) {
+        struct render_frame *f = R.parked[i];
+        for (int j = 0; j < f->nuploads; ++j) {
+            if (f->uploads[j].deferred && f->uploads[j].store == store) f->uploads[j].store = NULL;
+        }
+    }
+}
+
+/* Take over a frame from the queue: bring the view stores up to date, so
+ * frames for any output see the uploads of all frames submitted before
+ * them, and park it until its output has a free slot. Deferred uploads
+ * wait until the frame is drawn. */
+static void accept_frame(struct render_frame *f) {
+    for (int i = 0; i < f->nuploads; ++i) {
+        if (f->uploads[i].deferred) continue;
+        apply_upload(&f->uploads[i]);
+        cancel_deferred_uploads(f->uploads[i].store);
+    }
+
+    uint64_t serial = ++R.serial;
+    for (int i = 0; i < f->ndead; ++i) {
+        if (R.ndead == R.dead_cap) {
+            int cap = R.dead_cap ? R.dead_cap * 2 : 16;
+            struct dead_store *d = realloc(R.dead, (size_t)cap * sizeof(*d));
+            if (!d) {
+                /* leave the rest on f, freed after it is drawn */
+                memmove(f->dead, f->dead + i, (size_t)(f->ndead - i) * sizeof(*f->dead));
+                f->ndead -= i;
+                goto park;
+            }
+            R.dead = d;
+            R.dead_cap = cap;
+        }
+        R.dead[R.ndead++] = (struct dead_store){f->dead[i], serial};
+    }
+    f->ndead = 0;
+
+park:
+    for (int i = 0; i < R.nparked; ++i) {
+        struct render_frame *old = R.parked[i];
+        if (old->output != f->output) continue;
+        /* the newer snapshot replaces the older one, damage accumulates */
+        region_union(&f->damage, &old->damage);
+        R.parked[i] = f;
+        R.parked_serial[i] = serial;
+        frame_done(old);
+        return;
+    }
+    if (R.nparked == BACKEND_MAX_OUTPUTS) {
+        fprintf(stderr, "render: too many outputs, dropping a frame\n");
+        frame_done(f);
+        return;
+    }
+    R.parked[R.nparked] = f;
+    R.parked_serial[R.nparked++] = serial;
+}
+
+/* Free the stores no parked frame can reference any more */
+static void reap_dead(void) {
+    uint64_t oldest = UINT64_MAX;
+    for (int i = 0; i < R.nparked; ++i) {
+        if (R.parked_serial[i] < oldest) oldest = R.parked_serial[i];
+    }
+    int j = 0;
+    for (int i = 0; i < R.ndead; ++i) {
+        if (R.dead[i].serial <= oldest) view_store_destroy(R.dead[i].store);
+        else R.dead[j++] = R.dead[i];
+    }
+    R.ndead = j;
+}
+
+/* The output's remembered overlay placement, or a fresh entry for it
+ * (NULL if there is no room) */
+static struct overlay_assignment *overlay_assignment(uint32_t output) {
+    struct overlay_assignment *unused = NULL;
+    for (int i = 0; i < BACKEND_MAX_OUTPUTS; ++i) {
+        struct overlay_assignment *a = &R.assignments[i];
+        if (a->output == output) return a;
+        if (!a->output && !unused) unused = a;
+    }
+    if (unused) *unused = (struct overlay_assignment){.output = output, .n = -1};
+    return unused;
+}
+
+static int assignment_matches(const struct overlay_assignment *a, const struct render_frame *f) {
+    if (a->n != f->noverlays) return 0;
+    for (int i = 0; i < f->noverlays; ++i) {
+        const struct render_overlay *ov = &f->overlays[i];
+        if (a->c[i].store != ov->store || a->c[i].fmt != f->uploads[ov->upload].fmt ||
+            memcmp(&a->c[i].box, &ov->box, sizeof(ov->box)) != 0)
+            return 0;
+    }
+    return 1;
+}
+
+/* Whether every placed candidate of f shows a framebuffer it passed a
+ * test with */
+static int assignment_tested(const struct overlay_assignment *a, const struct render_frame *f, const int *placed) {
+    for (int i = 0; i < f->noverlays; ++i) {
+        if (!placed[i]) continue;
+        int k = 0;
+        while (k < OVERLAY_TESTED_FBS && a->c[i].tested[k] != f->overlays[i].fb_id) ++k;
+        if (k == OVERLAY_TESTED_FBS) return 0;
+    }
+    return 1;
+}
+
+/* Remember the framebuffers of f's placed candidates as tested */
+static void assignment_passed(struct overlay_assignment *a, const struct render_frame *f, const int *placed) {
+    for (int i = 0; i < f->noverlays; ++i) {
+        if (!placed[i]) continue;
+        uint32_t *t = a->c[i].tested;
+        int k = 0;
+        while (k < OVERLAY_TESTED_FBS - 1 && t[k] != f->overlays[i].fb_id) ++k;
+        memmove(&t[1], &t[0], sizeof(t[0]) * (size_t)k);
+        t[0] = f->overlays[i].fb_id;
+    }
+}
+
+/* The placed candidates of f as backend overlays, bottom first */
+static int placed_overlays(const struct render_frame *f, const int *placed, struct backend_overlay *out) {
+    int n = 0;
+    for (int i = f->noverlays - 1; i >= 0; --i) {
+        if (!placed[i]) continue;
+        const struct render_overlay *ov = &f->overlays[i];
+        out[n++] = (struct backend_overlay){
+            .fb_id = ov->fb_id,
+            .x = ov->box.x1,
+            .y = ov->box.y1,
+            .width = (uint32_t)(ov->box.x2 - ov->box.x1),
+            .height = (uint32_t)(ov->box.y2 - ov->box.y1),
+        };
+    }
+    return n;
+}
+
+/* Decide which overlay candidates of f go on planes. While the candidates
+ * are those of the output's last frame, its placement is kept, and tested
+ * whole only when a placed one shows a framebuffer it was not tested with;
+ * otherwise, or if that fails, candidates are tried topmost first, each
+ * kept if a TEST_ONLY commit of it with those kept so far passes. One under
+ * a candidate left to composition is composited too, or it would end up
+ * above it. */
+static void assign_overlays(const struct render_frame *f, int *placed) {
+    struct backend_overlay ov[BACKEND_MAX_OVERLAYS];
+    struct overlay_assignment *a = overlay_assignment(f->output);
+    if (a && assignment_matches(a, f)) {
+        for (int i = 0; i < f->noverlays; ++i) placed[i] = a->c[i].placed;
+        int n = placed_overlays(f, placed, ov);
+        if (n == 0 || assignment_tested(a, f, placed)) return;
+        if (backend->overlay_test(f->output, ov, n) == 0) {
+            assignment_passed(a, f, placed);
+            return;
+        }
+    }
+
+    /* a test must hold only the candidates kept so far */
+    memset(placed, 0, sizeof(int) * (size_t)f->noverlays);
+    struct region composited;
+    region_init(&composited);
+    for (int i = 0; i < f->noverlays; ++i) {
+        const struct rect *box = &f->overlays[i].box;
+        if (!region_intersects(&composited, box)) {
+            placed[i] = 1;
+            if (backend->overlay_test(f->output, ov, placed_overlays(f, placed, ov)) != 0) placed[i] = 0;
+        }
+        if (!placed[i]) region_add(&composited, box->x1, box->y1, box->x2 - box->x1, box->y2 - box->y1);
+    }
+
+    if (!a) return;
+    a->n = f->noverlays;
+    for (int i = 0; i < f->noverlays; ++i) {
+        const struct render_overlay *o = &f->overlays[i];
+        a->c[i].store = o->store;
+        a->c[i].box = o->box;
+        a->c[i].fmt = f->uploads[o->upload].fmt;
+        a->c[i].placed = placed[i];
+        memset(a->c[i].tested, 0, sizeof(a->c[i].tested));
+    }
+    /* the last passing test held exactly the placed candidates */
+    assignment_passed(a, f, placed);
+}
+
+/* Take a placed view out of the composition */
+static void snapshot_drop(struct scene_snapshot *snap, const struct view_store *store) {
+    for (int i = 0; i < snap->nrecs; ++i) {
+        if (snap->recs[i].store != store) continue;
+        memmove(&snap->recs[i], &snap->recs[i + 1], (size_t)(snap->nrecs - i - 1) * sizeof(snap->recs[0]));
+        snap->nrecs--;
+        return;
+    }
+}
+
+/* Place f's overlay candidates, filling out (bottom first) with those
+ * shown and returning their number. The rest are composited: their
+ * fallbacks are applied and their boxes, which the last frame may have
+ * left to a plane, damaged. */
+static int place_overlays(struct render_frame *f, struct backend_overlay *out) {
+    int placed[BACKEND_MAX_OVERLAYS] = {0};
+    assign_overlays(f, placed);
+    for (int i = 0; i < f->noverlays; ++i) {
+        struct render_overlay *ov = &f->overlays[i];
+        if (placed[i]) {
+            snapshot_drop(&f->snap, ov->store);
+            ov->result = RENDER_SCANOUT_SHOWN;
+        } else {
+            apply_upload(&f->uploads[ov->upload]);
+            region_add(&f->damage, ov->box.x1, ov->box.y1, ov->box.x2 - ov->box.x1, ov->box.y2 - ov->box.y1);
+            ov->result = RENDER_SCANOUT_COMPOSITED;
+        }
+    }
+    return placed_overlays(f, placed, out);
+}
+
+/* Composite and queue one frame, or scan its framebuffer out; a slot of
+ * its output is known to be free */
+static void draw_frame(struct render_frame *f) {
+    struct backend_overlay overlays[BACKEND_MAX_OVERLAYS];
+    int noverlays = 0;
+    if (f->scanout_fb && !region_is_empty(&f->damage) && backend->frame_scanout(f->output, f->scanout_fb) == 0) {
+        f->scanout_result = RENDER_SCANOUT_SHOWN;
+        region_init(&f->damage);
+    } else {
+        if (f->scanout_upload >= 0) {
+            apply_upload(&f->uploads[f->scanout_upload]);
+            f->scanout_result = RENDER_SCANOUT_COMPOSITED;
+        }
+        noverlays = place_overlays(f, overlays);
+    }
+
+    /* new overlay framebuffers are flipped in even without damage */
+    if (!region_is_empty(&f->damage) || noverlays > 0) {
+        struct backend_frame df;
+        int ret = backend->frame_begin(f->output, &df, &f->damage);
+        if (ret != 0) {
+            fprintf(stderr, "render: frame_begin failed\n");
+        } else {
+            scene_composite(&f->snap, &R.tiles, df.map, df.pitch, &df.repaint, df.write_combined);
+            df.noverlays = noverlays;
+            memcpy(df.overlays, overlays, sizeof(overlays[0]) * (size_t)noverlays);
+            ret = backend->frame_submit(f->output, &df);
+            if (ret != 0) fprintf(stderr, "render: frame_submit failed\n");
+        }
+        /* the overlays never reached the display */
+        for (int i = 0; ret != 0 && i < f->noverlays; ++i) {
+            if (f->overlays[i].result == RENDER_SCANOUT_SHOWN) f->overlays[i].result = RENDER_SCANOUT_SKIPPED;
+        }
+    }
+
+    for (int i = 0; i < f->ndead; ++i) view_store_destroy(f->dead[i]);
+    f->ndead = 0;
+    frame_done(f);
+}
+
+static void *render_main(void *arg) {
+    (void)arg;
+    struct pollfd fds[2] = {
+        {.fd = R.render_wake, .events = POLLIN},
+        {.fd = backend->get_fd(), .events = POLLIN},
+    };
+
+    while (!atomic_load(&R.quit)) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            perror("render: poll");
+            break;
+        }
+        if (fds[0].revents & POLLIN) drain(R.render_wake);
+        if (R.noverflow > 0 && flush_overflow()) wake(R.proto_wake);
+        if (fds[1].revents & (POLLHUP | POLLERR)) {
+            fprintf(stderr, "render: backend fd error\n");
+            fds[1].fd = -1;
+        } else if (fds[1].revents & POLLIN) {
+            backend->dispatch();
+        }
+
+        struct render_frame *f;
+        while (spsc_pop(&R.frames, &f)) accept_frame(f);
+
+        /* each output draws its frame as soon as it has a free slot; the
+         * next flip-done on a busy one retries */
+        for (int i = 0; i < R.nparked;) {
+            f = R.parked[i];
+            int ready = backend->can_present(f->output);
+            if (ready == 0) {
+                i++;
+                continue;
+            }
+            unpark(i);
+            if (ready > 0) draw_frame(f);
+            else frame_done(f); /* the output is gone */
+        }
+        reap_dead();
+    }
+    return NULL;
+}
+
+static void deliver_events(void) {
+    struct render_event ev;
+    while (spsc_pop(&R.events, &ev)) R.fn(&ev, R.fn_data);
+}
+
+static int proto_wake_cb(int fd, uint32_t mask, void *data) {
+    (void)mask; (void)data;
+    drain(fd);
+    deliver_events();
+    /* the render thread moves its overflow into the room made */
+    if (atomic_load(&R.backlog)) wake(R.render_wake);
+    return 0;
+}
+
+int render_start(struct wl_event_loop *loop, render_event_fn fn, void *data) {
+    if (R.running) return 0;
+    R.fn = fn;
+    R.fn_data = data;
+    atomic_store(&R.quit, 0);
+    atomic_store(&R.backlog, 0);
+
+    if (spsc_init(&R.frames, sizeof(struct render_frame *), FRAME_QUEUE) != 0) return -1;
+    if (spsc_init(&R.events, sizeof(struct render_event), EVENT_QUEUE) != 0) goto fail;
+    R.render_wake = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    R.proto_wake = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (R.render_wake < 0 || R.proto_wake < 0) {
+        perror("render: eventfd");
+        goto fail;
+    }
+    R.proto_source = wl_event_loop_add_fd(loop, R.proto_wake, WL_EVENT_READABLE, proto_wake_cb, NULL);
+    if (!R.proto_source) goto fail;
+
+    /* outputs already present are announced right away, and queued for
+     * the protocol thread like any other event */
+    backend->set_flip_done_handler(flip_done, NULL);
+    backend->set_output_handler(output_changed, NULL);
+    /* signals are left to the protocol thread's event loop */
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    int ret = pthread_create(&R.thread, NULL, render_main, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (ret != 0) {
+        errno = ret;
+        perror("render: pthread_create");
+        backend->set_flip_done_handler(NULL, NULL);
+        backend->set_output_handler(NULL, NULL);
+        goto fail;
+    }
+    R.running = 1;
+    return 0;
+
+fail:
+    if (R.proto_source) wl_event_source_remove(R.proto_source);
+    R.proto_source = NULL;
+    if (R.render_wake >= 0) close(R.render_wake);
+    if (R.proto_wake >= 0) close(R.proto_wake);
+    R.render_wake = R.proto_wake = -1;
+    spsc_fini(&R.events);
+    spsc_fini(&R.frames);
+    return -1;
+}
+
+void render_stop(void) {
+    if (!R.running) return;
+    atomic_store(&R.quit, 1);
+    wake(R.render_wake);
+    pthread_join(R.thread, NULL);
+    R.running = 0;
+    backend->set_flip_done_handler(NULL, NULL);
+    backend->set_output_handler(NULL, NULL);
+
+    /* the thread is gone, so what it left behind is handled here; nothing
+     * draws from the stores of destroyed views any more */
+    for (int i = 0; i < R.ndead; ++i) view_store_destroy(R.dead[i].store);
+    free(R.dead);
+    R.dead = NULL;
+    R.ndead = R.dead_cap = 0;
+    deliver_events();
+    for (int i = 0; i < R.noverflow; ++i) R.fn(&R.overflow[i], R.fn_data);
+    free(R.overflow);
+    R.overflow = NULL;
+    R.noverflow = R.overflow_cap = 0;
+    struct render_frame *f;
+    while (R.nparked > 0 || spsc_pop(&R.frames, &f)) {
+        if (R.nparked > 0) f = R.parked[--R.nparked];
+        for (int i = 0; i < f->ndead; ++i) view_store_destroy(f->dead[i]);
+        f->ndead = 0;
+        struct render_event ev = done_event(f);
+        R.fn(&ev, R.fn_data);
+    }
+
+    wl_event_source_remove(R.proto_source);
+    R.proto_source = NULL;
+    close(R.render_wake);
+    close(R.proto_wake);
+    R.render_wake = R.proto_wake = -1;
+    spsc_fini(&R.events);
+    spsc_fini(&R.frames);
+    free(R.tiles.tiles);
+    memset(&R.tiles, 0, sizeof(R.tiles));
+}
+
+int render_running(void) {
+    return R.running;
+}
+
+int render_submit(struct render_frame *f) {
+    if (!R.running || spsc_push(&R.frames, &f) != 0) return -1;
+    wake(R.render_wake);
+    return 0;
+}
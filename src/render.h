@@ -0,0 +1,132 @@
+#ifndef ARGUS_RENDER_H
+#define ARGUS_RENDER_H
+
+#include "backend.h"
+#include "convert.h"
+#include "region.h"
+#include "scene.h"
+
+#include <stdint.h>
+#include <wayland-server-core.h>
+
+/* Render thread: owns composition and KMS submission, so a slow repaint
+ * never holds up client requests or input on the protocol thread.
+ *
+ * The protocol thread describes each repaint of an output as an immutable
+ * render_frame (draw records, client pixels to upload, output damage) and
+ * hands it over with render_submit(). The render thread applies the uploads
+ * right away, in submission order, since view stores are shared by all
+ * outputs; the drawing then waits for a free swapchain slot on the frame's
+ * output, without holding up frames for other outputs. A frame may instead
+ * name a client framebuffer to scan out as it is (direct scanout), and is
+ * only composited if the backend cannot show that; or it may propose client
+ * framebuffers for overlay planes, of which the render thread places what
+ * the hardware accepts and composites the rest. Once composited and
+ * queued, the frame is reported back as RENDER_EVENT_DONE; flip completions
+ * and outputs appearing or disappearing come back as events too. Both
+ * directions are lock-free single-producer/single-consumer queues, with an
+ * eventfd to wake the other side: the render thread polls its own and the
+ * backend fd, the protocol thread watches the other from its event loop,
+ * where events are delivered to the handler given to render_start().
+ */
+
+/* Convert damaged pixels of a client buffer into a view's store. The
+ * buffer must stay mapped and unchanged until the frame is done. */
+struct render_upload {
+    struct view_store *store;
+    const void *data;
+    uint32_t stride, width, height;
+    const struct pixel_format *fmt;
+    struct region damage; /* buffer coordinates */
+    int sync_fd; /* dmabuf whose CPU reads are bracketed with DMA_BUF_IOCTL_SYNC, or -1 */
+    /* the fallback of a direct scanout or overlay, only applied when the
+     * frame composites the buffer after all */
+    int deferred;
+    void *buffer; /* caller's handle, untouched */
+};
+
+/* What became of a frame's direct scanout or overlay, by the time it is
+ * DONE */
+enum render_scanout_result {
+    RENDER_SCANOUT_SKIPPED, /* the frame was never drawn */
+    RENDER_SCANOUT_SHOWN, /* the framebuffer was queued as it is */
+    RENDER_SCANOUT_COMPOSITED, /* the fallback upload was applied and the frame drawn */
+};
+
+/* A client framebuffer proposed for an overlay plane: shown unscaled over
+ * box (output coordinates), in place of the draw record of store, or else
+ * composited from its deferred upload */
+struct render_overlay {
+    uint32_t fb_id;
+    struct rect box;
+    const struct view_store *store;
+    int upload;
+    enum render_scanout_result result;
+};
+
+struct render_frame {
+    uint32_t output; /* backend output id */
+    struct region damage; /* output damage, output coordinates */
+    struct scene_snapshot snap;
+    struct render_upload *uploads;
+    int nuploads, uploads_cap;
+    /* Direct scanout: backend framebuffer to show instead of compositing
+     * (0 for none), and the upload of the same buffer, applied only if it
+     * cannot be shown (-1 for none). The render thread fills in the result
+     * and may drop that upload (store NULL) if a newer one overtakes it. */
+    uint32_t scanout_fb;
+    int scanout_upload;
+    enum render_scanout_result scanout_result;
+    /* Overlay candidates, topmost first, for frames without a direct
+     * scanout; the render thread fills in their results */
+    struct render_overlay overlays[BACKEND_MAX_OVERLAYS];
+    int noverlays;
+    /* stores of destroyed views, freed once this frame and every frame
+     * submitted before it are drawn (no later frame can reference them) */
+    struct view_store **dead;
+    int ndead, dead_cap;
+    void *user; /* caller's data, untouched */
+};
+
+enum render_event_type {
+    RENDER_EVENT_DONE, /* frame drawn and queued, or dropped; caller frees it */
+    RENDER_EVENT_FLIP, /* a frame reached the screen */
+    RENDER_EVENT_OUTPUT_ADDED, /* an output appeared (also those present at start) */
+    RENDER_EVENT_OUTPUT_REMOVED, /* an output went away; its frames are dropped */
+};
+
+struct render_event {
+    enum render_event_type type;
+    uint32_t output;
+    struct render_frame *frame; /* DONE */
+    uint64_t present_seq; /* DONE: backend->present_seq() after the frame */
+    uint64_t done_ns; /* DONE: CLOCK_MONOTONIC time the flip was queued */
+    uint64_t scanout_seq; /* DONE, FLIP: backend->scanout_seq() */
+    uint32_t vblank; /* FLIP: kernel vblank counter */
+    uint32_t sec, usec; /* FLIP: flip timestamp */
+    uint64_t refresh_ns; /* FLIP: backend->refresh_ns() */
+    struct backend_output_info info; /* OUTPUT_* */
+};
+
+typedef void (*render_event_fn)(const struct render_event *ev, void *data);
+
+struct render_frame *render_frame_create(void);
+/* Also frees the dead stores still on f, so only for frames the render
+ * thread is done with or never saw */
+void render_frame_destroy(struct render_frame *f);
+/* Returns a zeroed upload (sync_fd -1), or NULL if out of memory */
+struct render_upload *render_frame_add_upload(struct render_frame *f);
+int render_frame_add_dead(struct render_frame *f, struct view_store *store);
+
+/* Start the thread; it takes over the backend fd, flip-done and output
+ * handlers */
+int render_start(struct wl_event_loop *loop, render_event_fn fn, void *data);
+/* Join the thread. Frames it never drew, and events still queued, are
+ * delivered to the handler before this returns. */
+void render_stop(void);
+int render_running(void);
+
+/* Pass a frame to the render thread. Returns -1 if the queue is full. */
+int render_submit(struct render_frame *f);
+
+#endif
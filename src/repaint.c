@@ -0,0 +1,79 @@
+#include "repaint.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define MIN_SAMPLES 8 /* below this the estimate is not trusted */
+
+void repaint_sched_init(struct repaint_sched *rs, uint64_t refresh_ns) {
+    memset(rs, 0, sizeof(*rs));
+    const char *env = getenv("ARGUS_REPAINT_SCHED");
+    rs->enabled = !(env && strcmp(env, "0") == 0);
+    env = getenv("ARGUS_REPAINT_MARGIN_US");
+    rs->margin_ns = (env ? (uint64_t)strtoull(env, NULL, 10) : 1000) * 1000;
+    rs->refresh_ns = refresh_ns;
+}
+
+/* First predicted vblank at or after t */
+static uint64_t next_vblank(const struct repaint_sched *rs, uint64_t t) {
+    if (t <= rs->vblank_ns) return rs->vblank_ns;
+    uint64_t n = (t - rs->vblank_ns + rs->refresh_ns - 1) / rs->refresh_ns;
+    return rs->vblank_ns + n * rs->refresh_ns;
+}
+
+uint64_t repaint_sched_start(struct repaint_sched *rs, uint64_t now_ns) {
+    uint64_t budget = rs->p95_ns + rs->margin_ns;
+    rs->plan_target_ns = 0;
+    rs->plan_start_ns = now_ns;
+    if (!rs->enabled || !rs->vblank_ns || !rs->refresh_ns || rs->nsamples < MIN_SAMPLES ||
+        budget >= rs->refresh_ns)
+        return now_ns;
+
+    /* the earliest vblank the repaint can make, and never the one the
+     * previous frame is still waiting for */
+    uint64_t earliest = now_ns + budget;
+    if (rs->target_ns && earliest < rs->target_ns + rs->refresh_ns / 2)
+        earliest = rs->target_ns + rs->refresh_ns / 2;
+
+    rs->plan_target_ns = next_vblank(rs, earliest);
+    rs->plan_start_ns = rs->plan_target_ns - budget;
+    return rs->plan_start_ns;
+}
+
+void repaint_sched_begin(struct repaint_sched *rs, uint64_t now_ns) {
+    if (rs->plan_target_ns && now_ns > rs->plan_start_ns + rs->margin_ns) rs->stats.late++;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void update_p95(struct repaint_sched *rs) {
+    uint64_t sorted[REPAINT_SAMPLES];
+    memcpy(sorted, rs->samples, rs->nsamples * sizeof(sorted[0]));
+    qsort(sorted, rs->nsamples, sizeof(sorted[0]), cmp_u64);
+    rs->p95_ns = sorted[(rs->nsamples * 95 + 99) / 100 - 1];
+    rs->stats.budget_ns = rs->p95_ns + rs->margin_ns;
+}
+
+void repaint_sched_done(struct repaint_sched *rs, uint64_t begin_ns, uint64_t done_ns, uint64_t seq) {
+    /* repaints that drew nothing say nothing about the cost of drawing */
+    if (seq <= rs->target_seq) return;
+    rs->stats.frames++;
+    rs->target_seq = seq;
+    rs->target_ns = rs->plan_target_ns;
+
+    rs->samples[rs->next] = done_ns > begin_ns ? done_ns - begin_ns : 0;
+    rs->next = (rs->next + 1) % REPAINT_SAMPLES;
+    if (rs->nsamples < REPAINT_SAMPLES) rs->nsamples++;
+    update_p95(rs);
+}
+
+void repaint_sched_flip(struct repaint_sched *rs, uint64_t vblank_ns, uint64_t refresh_ns, uint64_t scanout_seq) {
+    rs->vblank_ns = vblank_ns;
+    if (refresh_ns) rs->refresh_ns = refresh_ns;
+    if (!rs->target_ns || scanout_seq < rs->target_seq) return;
+    if (vblank_ns > rs->target_ns + rs->refresh_ns / 2) rs->stats.missed++;
+    rs->target_ns = 0;
+}
@@ -0,0 +1,65 @@
+#ifndef ARGUS_REPAINT_H
+#define ARGUS_REPAINT_H
+
+#include <stdint.h>
+
+/* Adaptive repaint window. Rather than latching client state as soon as
+ * the output is dirty, the repaint starts as late as it can while still
+ * making the next vblank: at the predicted vblank minus the p95 of recent
+ * repaint durations (latch to flip queued) minus a safety margin
+ * (ARGUS_REPAINT_MARGIN_US, default 1000). Vblanks are predicted from the
+ * last flip timestamp and the measured refresh period. ARGUS_REPAINT_SCHED=0
+ * repaints immediately instead.
+ *
+ * Until enough samples exist, or when the budget does not fit in a
+ * refresh period, the repaint starts immediately. All times are
+ * CLOCK_MONOTONIC nanoseconds.
+ */
+#define REPAINT_SAMPLES 64
+
+struct repaint_stats {
+    uint64_t frames; /* repaints that queued a flip */
+    uint64_t missed; /* ... and were shown after the vblank they aimed for */
+    uint64_t late; /* repaints that started well after their planned start */
+    uint64_t bypassed; /* frames that scanned a client buffer out directly */
+    uint64_t overlaid; /* client buffers shown on overlay planes, per frame */
+    uint64_t budget_ns; /* current p95 + margin */
+};
+
+struct repaint_sched {
+    int enabled;
+    uint64_t margin_ns;
+
+    uint64_t samples[REPAINT_SAMPLES]; /* repaint durations, ring */
+    unsigned nsamples, next;
+    uint64_t p95_ns;
+
+    uint64_t vblank_ns; /* last flip */
+    uint64_t refresh_ns;
+
+    /* the frame drawn last, the vblank it aims for, waiting to be shown */
+    uint64_t target_seq;
+    uint64_t target_ns;
+    /* vblank the repaint being planned aims for, and when it should start */
+    uint64_t plan_target_ns;
+    uint64_t plan_start_ns;
+
+    struct repaint_stats stats;
+};
+
+void repaint_sched_init(struct repaint_sched *rs, uint64_t refresh_ns);
+
+/* When to start the next repaint (<= now to start right away) */
+uint64_t repaint_sched_start(struct repaint_sched *rs, uint64_t now_ns);
+
+/* The planned repaint started at now_ns */
+void repaint_sched_begin(struct repaint_sched *rs, uint64_t now_ns);
+
+/* The repaint begun last finished at done_ns; it queued frame seq, or drew
+ * nothing if seq is not newer than the last one */
+void repaint_sched_done(struct repaint_sched *rs, uint64_t begin_ns, uint64_t done_ns, uint64_t seq);
+
+/* A flip showing frame scanout_seq landed at vblank_ns */
+void repaint_sched_flip(struct repaint_sched *rs, uint64_t vblank_ns, uint64_t refresh_ns, uint64_t scanout_seq);
+
+#endif
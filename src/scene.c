@@ -0,0 +1,377 @@
+#include "scene.h"
+#include "blend.h"
+#include "stream.h"
+#include "workers.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static struct rect view_box(const struct scene_view *v) {
+    struct rect r = {v->x, v->y, v->x + (int32_t)v->width, v->y + (int32_t)v->height};
+    return r;
+}
+
+static int rect_intersect(const struct rect *a, const struct rect *b, struct rect *out) {
+    out->x1 = a->x1 > b->x1 ? a->x1 : b->x1;
+    out->y1 = a->y1 > b->y1 ? a->y1 : b->y1;
+    out->x2 = a->x2 < b->x2 ? a->x2 : b->x2;
+    out->y2 = a->y2 < b->y2 ? a->y2 : b->y2;
+    return out->x1 < out->x2 && out->y1 < out->y2;
+}
+
+/* Damage the layout area covered by v */
+static void damage_view(struct scene *sc, const struct scene_view *v) {
+    region_add(&sc->damage, v->x, v->y, (int32_t)v->width, (int32_t)v->height);
+    region_clip(&sc->damage, sc->width, sc->height);
+}
+
+void scene_init(struct scene *sc, int32_t width, int32_t height, uint32_t background) {
+    memset(sc, 0, sizeof(*sc));
+    wl_list_init(&sc->views);
+    sc->width = width;
+    sc->height = height;
+    sc->background = background;
+    region_init(&sc->damage);
+    region_add(&sc->damage, 0, 0, width, height);
+}
+
+void scene_fini(struct scene *sc) {
+    free(sc->recs);
+    sc->recs = NULL;
+    sc->nrecs = sc->recs_cap = 0;
+}
+
+void scene_set_size(struct scene *sc, int32_t width, int32_t height) {
+    sc->width = width;
+    sc->height = height;
+    sc->stacking_dirty = 1;
+    region_init(&sc->damage);
+    region_add(&sc->damage, 0, 0, width, height);
+}
+
+void scene_view_init(struct scene_view *v, struct view_store *store) {
+    memset(v, 0, sizeof(*v));
+    wl_list_init(&v->link);
+    v->store = store;
+}
+
+void scene_view_fini(struct scene *sc, struct scene_view *v) {
+    scene_view_unmap(sc, v);
+    v->store = NULL;
+}
+
+void scene_view_map(struct scene *sc, struct scene_view *v) {
+    if (v->mapped) return;
+    wl_list_insert(sc->views.prev, &v->link);
+    v->mapped = 1;
+    sc->stacking_dirty = 1;
+    damage_view(sc, v);
+}
+
+void scene_view_unmap(struct scene *sc, struct scene_view *v) {
+    if (!v->mapped) return;
+    wl_list_remove(&v->link);
+    wl_list_init(&v->link);
+    v->mapped = 0;
+    sc->stacking_dirty = 1;
+    damage_view(sc, v);
+}
+
+void scene_view_raise(struct scene *sc, struct scene_view *v) {
+    if (!v->mapped || v->link.next == &sc->views) return;
+    wl_list_remove(&v->link);
+    wl_list_insert(sc->views.prev, &v->link);
+    sc->stacking_dirty = 1;
+    damage_view(sc, v);
+}
+
+void scene_view_move(struct scene *sc, struct scene_view *v, int32_t x, int32_t y) {
+    if (v->x == x && v->y == y) return;
+    if (v->mapped) damage_view(sc, v);
+    v->x = x;
+    v->y = y;
+    if (v->mapped) {
+        damage_view(sc, v);
+        sc->stacking_dirty = 1;
+    }
+}
+
+void scene_view_set_opaque(struct scene *sc, struct scene_view *v, int opaque) {
+    if (v->opaque == opaque) return;
+    v->opaque = opaque;
+    if (v->mapped) {
+        damage_view(sc, v);
+        sc->stacking_dirty = 1;
+    }
+}
+
+void scene_view_resize(struct scene *sc, struct scene_view *v, uint32_t width, uint32_t height) {
+    if (v->width == width && v->height == height) return;
+    if (v->mapped) damage_view(sc, v);
+    v->width = width;
+    v->height = height;
+    if (v->mapped) {
+        damage_view(sc, v);
+        sc->stacking_dirty = 1;
+    }
+}
+
+void scene_view_damage(struct scene *sc, struct scene_view *v, const struct region *damage) {
+    if (!v->mapped) return;
+    struct region clip = *damage;
+    region_clip(&clip, (int32_t)v->width, (int32_t)v->height);
+    for (int i = 0; i < clip.n; ++i) {
+        const struct rect *r = &clip.r[i];
+        region_add(&sc->damage, v->x + r->x1, v->y + r->y1, r->x2 - r->x1, r->y2 - r->y1);
+    }
+    region_clip(&sc->damage, sc->width, sc->height);
+}
+
+/* Flatten the mapped views into draw records, bottom to top, dropping any
+ * that are empty or entirely off the layout */
+static void rebuild_draw_recs(struct scene *sc) {
+    struct rect layout = {0, 0, sc->width, sc->height};
+    struct scene_view *v;
+
+    sc->nrecs = 0;
+    wl_list_for_each(v, &sc->views, link) {
+        struct rect box = view_box(v);
+        if (!rect_intersect(&box, &layout, &box)) continue;
+        if (sc->nrecs == sc->recs_cap) {
+            int cap = sc->recs_cap ? sc->recs_cap * 2 : 16;
+            struct draw_rec *recs = realloc(sc->recs, (size_t)cap * sizeof(*recs));
+            if (!recs) break; /* draw what fits; retried on the next change */
+            sc->recs = recs;
+            sc->recs_cap = cap;
+        }
+        struct draw_rec *rec = &sc->recs[sc->nrecs++];
+        rec->box = box;
+        rec->x = v->x;
+        rec->y = v->y;
+        rec->store = v->store;
+        rec->opaque = v->opaque;
+    }
+    sc->stacking_dirty = 0;
+}
+
+struct scene_view *scene_view_at(struct scene *sc, int32_t x, int32_t y) {
+    struct scene_view *v;
+    wl_list_for_each_reverse(v, &sc->views, link) {
+        struct rect b = view_box(v);
+        if (x >= b.x1 && x < b.x2 && y >= b.y1 && y < b.y2) return v;
+    }
+    return NULL;
+}
+
+void scene_take_damage(struct scene *sc, struct region *out) {
+    region_union(out, &sc->damage);
+    region_init(&sc->damage);
+}
+
+int scene_snapshot(struct scene *sc, const struct rect *output, struct scene_snapshot *snap) {
+    if (sc->stacking_dirty) rebuild_draw_recs(sc);
+    snap->width = output->x2 - output->x1;
+    snap->height = output->y2 - output->y1;
+    snap->background = sc->background;
+    snap->nrecs = 0;
+    snap->recs = NULL;
+    if (sc->nrecs == 0) return 0;
+    snap->recs = malloc((size_t)sc->nrecs * sizeof(*snap->recs));
+    if (!snap->recs) return -1;
+    for (int i = 0; i < sc->nrecs; ++i) {
+        struct draw_rec rec = sc->recs[i];
+        if (!rect_intersect(&sc->recs[i].box, output, &rec.box)) continue;
+        rec.box.x1 -= output->x1;
+        rec.box.y1 -= output->y1;
+        rec.box.x2 -= output->x1;
+        rec.box.y2 -= output->y1;
+        rec.x -= output->x1;
+        rec.y -= output->y1;
+        snap->recs[snap->nrecs++] = rec;
+    }
+    return 0;
+}
+
+void scene_snapshot_fini(struct scene_snapshot *snap) {
+    free(snap->recs);
+    snap->recs = NULL;
+    snap->nrecs = 0;
+}
+
+struct view_store *view_store_create(void) {
+    return calloc(1, sizeof(struct view_store));
+}
+
+void view_store_destroy(struct view_store *st) {
+    if (!st) return;
+    free(st->pixels);
+    free(st);
+}
+
+int view_store_upload(struct view_store *st, const void *src, uint32_t stride, uint32_t width,
+                      uint32_t height, const struct pixel_format *fmt, const struct region *damage) {
+    if (st->width != width || st->height != height || !st->pixels) {
+        uint32_t *pixels = calloc((size_t)width * height, 4);
+        if (!pixels) return -1;
+        free(st->pixels);
+        st->pixels = pixels;
+        st->width = width;
+        st->height = height;
+    }
+
+    struct region clip = *damage;
+    region_clip(&clip, (int32_t)width, (int32_t)height);
+
+    const uint8_t *s = src;
+    for (int i = 0; i < clip.n; ++i) {
+        const struct rect *r = &clip.r[i];
+        size_t n = (size_t)(r->x2 - r->x1);
+        for (int32_t y = r->y1; y < r->y2; ++y)
+            fmt->convert(st->pixels + (size_t)y * width + r->x1,
+                         s + (size_t)y * stride + (size_t)r->x1 * fmt->bpp, n);
+    }
+    return 0;
+}
+
+/* Solid and opaque spans are streamed into write-combined memory, but
+ * kept in the cache when dst is the shadow framebuffer, where blended
+ * views on top will read them back */
+static void fill_rect(uint8_t *dst, uint32_t pitch, const struct rect *r, uint32_t color, int wc) {
+    size_t n = (size_t)(r->x2 - r->x1);
+    for (int32_t y = r->y1; y < r->y2; ++y) {
+        uint32_t *row = (uint32_t *)(dst + (size_t)y * pitch) + r->x1;
+        if (wc) {
+            stream_fill32(row, color, n);
+            continue;
+        }
+        for (size_t x = 0; x < n; ++x) row[x] = color;
+    }
+}
+
+static void copy_rect(uint8_t *dst, uint32_t pitch, const struct rect *r, const struct draw_rec *rec, int wc) {
+    const struct view_store *st = rec->store;
+    size_t len = (size_t)(r->x2 - r->x1) * 4;
+    for (int32_t y = r->y1; y < r->y2; ++y) {
+        const uint32_t *src = st->pixels + (size_t)(y - rec->y) * st->width + (r->x1 - rec->x);
+        if (wc) stream_copy(dst + (size_t)y * pitch + (size_t)r->x1 * 4, src, len);
+        else memcpy(dst + (size_t)y * pitch + (size_t)r->x1 * 4, src, len);
+    }
+}
+
+static void blend_rect(uint8_t *dst, uint32_t pitch, const struct rect *r, const struct draw_rec *rec) {
+    const struct view_store *st = rec->store;
+    size_t n = (size_t)(r->x2 - r->x1);
+    for (int32_t y = r->y1; y < r->y2; ++y) {
+        const uint32_t *src = st->pixels + (size_t)(y - rec->y) * st->width + (r->x1 - rec->x);
+        blend_over_span((uint32_t *)(dst + (size_t)y * pitch) + r->x1, src, n);
+    }
+}
+
+/* Draw one rectangle of the output, bottom to top */
+static void composite_area(const struct scene_snapshot *snap, uint8_t *dst, uint32_t pitch,
+                           const struct rect *area, int wc) {
+    /* everything under the topmost opaque view covering the whole area is
+     * hidden, so start there */
+    int first = -1;
+    for (int j = snap->nrecs - 1; j >= 0; --j) {
+        const struct rect *b = &snap->recs[j].box;
+        if (!snap->recs[j].opaque) continue;
+        if (b->x1 <= area->x1 && b->y1 <= area->y1 && b->x2 >= area->x2 && b->y2 >= area->y2) {
+            first = j;
+            break;
+        }
+    }
+    if (first < 0) {
+        fill_rect(dst, pitch, area, snap->background, wc);
+        first = 0;
+    }
+
+    for (int j = first; j < snap->nrecs; ++j) {
+        struct rect part;
+        if (!rect_intersect(&snap->recs[j].box, area, &part)) continue;
+        if (snap->recs[j].opaque) copy_rect(dst, pitch, &part, &snap->recs[j], wc);
+        else blend_rect(dst, pitch, &part, &snap->recs[j]);
+    }
+}
+
+struct composite_job {
+    const struct scene_snapshot *snap;
+    const struct tile_list *tl;
+    int32_t tiles_x;
+    uint8_t *dst;
+    uint32_t pitch;
+    const struct region *repaint;
+    int wc;
+};
+
+/* Worker item: one damaged tile. Tiles are disjoint, so workers never touch
+ * the same pixels; repaint rectangles overlapping inside a tile are drawn
+ * in order, as on a single thread. */
+static void composite_tile(void *ctx, unsigned index) {
+    const struct composite_job *job = ctx;
+    uint32_t t = job->tl->tiles[index];
+    int32_t tx = (int32_t)(t % (uint32_t)job->tiles_x), ty = (int32_t)(t / (uint32_t)job->tiles_x);
+    struct rect cell = {tx * SCENE_TILE, ty * SCENE_TILE, (tx + 1) * SCENE_TILE, (ty + 1) * SCENE_TILE};
+
+    for (int i = 0; i < job->repaint->n; ++i) {
+        struct rect area;
+        if (rect_intersect(&job->repaint->r[i], &cell, &area))
+            composite_area(job->snap, job->dst, job->pitch, &area, job->wc);
+    }
+    /* streaming stores are per thread; order them before the flip */
+    if (job->wc) stream_fence();
+}
+
+/* List the tiles that intersect the repaint region */
+static int collect_tiles(struct tile_list *tl, int32_t tiles_x, const struct region *repaint) {
+    struct rect ext = region_extents(repaint);
+    int32_t tx1 = ext.x1 / SCENE_TILE, ty1 = ext.y1 / SCENE_TILE;
+    int32_t tx2 = (ext.x2 + SCENE_TILE - 1) / SCENE_TILE, ty2 = (ext.y2 + SCENE_TILE - 1) / SCENE_TILE;
+
+    tl->n = 0;
+    for (int32_t ty = ty1; ty < ty2; ++ty) {
+        for (int32_t tx = tx1; tx < tx2; ++tx) {
+            struct rect cell = {tx * SCENE_TILE, ty * SCENE_TILE, (tx + 1) * SCENE_TILE, (ty + 1) * SCENE_TILE};
+            struct rect tmp;
+            int hit = 0;
+            for (int i = 0; i < repaint->n && !hit; ++i) hit = rect_intersect(&repaint->r[i], &cell, &tmp);
+            if (!hit) continue;
+            if (tl->n == tl->cap) {
+                unsigned cap = tl->cap ? tl->cap * 2 : 256;
+                uint32_t *tiles = realloc(tl->tiles, cap * sizeof(*tiles));
+                if (!tiles) return -1;
+                tl->tiles = tiles;
+                tl->cap = cap;
+            }
+            tl->tiles[tl->n++] = (uint32_t)(ty * tiles_x + tx);
+        }
+    }
+    return 0;
+}
+
+/* Uploads may have failed or not happened yet: draw each view only where
+ * its store actually has pixels */
+static void clip_to_stores(struct scene_snapshot *snap) {
+    for (int i = 0; i < snap->nrecs; ++i) {
+        struct draw_rec *rec = &snap->recs[i];
+        const struct view_store *st = rec->store;
+        struct rect have = {rec->x, rec->y, rec->x + (int32_t)st->width, rec->y + (int32_t)st->height};
+        if (!st->pixels || !rect_intersect(&rec->box, &have, &rec->box))
+            rec->box.x2 = rec->box.x1; /* empty: never intersects */
+    }
+}
+
+void scene_composite(struct scene_snapshot *snap, struct tile_list *tl, void *dst, uint32_t pitch,
+                     const struct region *repaint, int write_combined) {
+    clip_to_stores(snap);
+
+    int32_t tiles_x = (snap->width + SCENE_TILE - 1) / SCENE_TILE;
+    if (collect_tiles(tl, tiles_x, repaint) != 0) {
+        /* no memory for the tile list: draw on this thread */
+        for (int i = 0; i < repaint->n; ++i) composite_area(snap, dst, pitch, &repaint->r[i], write_combined);
+        return;
+    }
+
+    struct composite_job job = {snap, tl, tiles_x, dst, pitch, repaint, write_combined};
+    workers_run(composite_tile, &job, tl->n);
+}
@@ -0,0 +1,129 @@
+#ifndef ARGUS_SCENE_H
+#define ARGUS_SCENE_H
+
+#include "convert.h"
+#include "region.h"
+
+#include <stdint.h>
+#include <wayland-util.h>
+
+/* Software scene: a stack of views composited bottom to top into output
+ * buffers, opaque views by copying and the rest with blend_over_span().
+ * Views live in one global (layout) coordinate space which the outputs
+ * tile; each output composites the part of the scene it shows.
+ *
+ * The scene proper is geometry only (position, size, stacking, and the
+ * layout damage every change causes) and belongs to the protocol thread.
+ * Pixels live in a view_store per view which only the render thread
+ * touches: it converts client buffers into the store and composites from
+ * it, so client buffers can be released as soon as their damage has been
+ * uploaded.
+ *
+ * Composition walks a flat array of draw records (one per visible view,
+ * already clipped to the layout) which is only rebuilt when views are
+ * mapped, unmapped, moved, resized or restacked; scene_snapshot() copies
+ * the records an output shows for a frame, in output coordinates.
+ */
+struct view_store {
+    uint32_t *pixels; /* premultiplied ARGB8888, stride width * 4 */
+    uint32_t width, height;
+};
+
+struct scene_view {
+    struct wl_list link; /* scene.views, bottom first */
+    int mapped;
+    int32_t x, y;
+    uint32_t width, height;
+    int opaque; /* alpha is ignored and the view hides what is below */
+    struct view_store *store;
+};
+
+struct draw_rec {
+    struct rect box; /* clipped to the layout (output, in a snapshot) */
+    int32_t x, y; /* view origin */
+    const struct view_store *store;
+    int opaque;
+};
+
+struct scene {
+    struct wl_list views;
+    int32_t width, height; /* layout */
+    uint32_t background;
+
+    struct draw_rec *recs;
+    int nrecs, recs_cap;
+    int stacking_dirty;
+
+    struct region damage;
+};
+
+/* The draw records of one output frame, owned by that frame */
+struct scene_snapshot {
+    struct draw_rec *recs;
+    int nrecs;
+    int32_t width, height;
+    uint32_t background;
+};
+
+/* Composition splits the repaint area into SCENE_TILE-square tiles, which
+ * the worker pool draws in parallel */
+#define SCENE_TILE 64
+
+/* Damaged tiles of the frame being composited (ty * tiles_x + tx) */
+struct tile_list {
+    uint32_t *tiles;
+    unsigned n, cap;
+};
+
+/* Protocol thread */
+
+void scene_init(struct scene *sc, int32_t width, int32_t height, uint32_t background);
+void scene_fini(struct scene *sc);
+/* Resize the layout, damaging all of it */
+void scene_set_size(struct scene *sc, int32_t width, int32_t height);
+
+void scene_view_init(struct scene_view *v, struct view_store *store);
+/* Unmaps the view; the store is left to the caller */
+void scene_view_fini(struct scene *sc, struct scene_view *v);
+
+/* Put the view on top of the stack / take it out of the scene */
+void scene_view_map(struct scene *sc, struct scene_view *v);
+void scene_view_unmap(struct scene *sc, struct scene_view *v);
+void scene_view_raise(struct scene *sc, struct scene_view *v);
+void scene_view_move(struct scene *sc, struct scene_view *v, int32_t x, int32_t y);
+void scene_view_set_opaque(struct scene *sc, struct scene_view *v, int opaque);
+void scene_view_resize(struct scene *sc, struct scene_view *v, uint32_t width, uint32_t height);
+
+/* Damage part of the view (view coordinates) */
+void scene_view_damage(struct scene *sc, struct scene_view *v, const struct region *damage);
+
+/* Topmost mapped view under layout point (x, y), or NULL */
+struct scene_view *scene_view_at(struct scene *sc, int32_t x, int32_t y);
+
+/* Move accumulated layout damage into out */
+void scene_take_damage(struct scene *sc, struct region *out);
+
+/* Copy the draw records visible in the output area of the layout into
+ * snap, translated to output coordinates. Returns -1 if out of memory. */
+int scene_snapshot(struct scene *sc, const struct rect *output, struct scene_snapshot *snap);
+void scene_snapshot_fini(struct scene_snapshot *snap);
+
+/* Render thread */
+
+struct view_store *view_store_create(void);
+void view_store_destroy(struct view_store *st);
+
+/* Convert the damaged parts (view coordinates) of a width x height buffer
+ * src, in format fmt, into the store. A store of another size is
+ * reallocated first and is black until drawn. Returns -1 if out of memory. */
+int view_store_upload(struct view_store *st, const void *src, uint32_t stride, uint32_t width,
+                      uint32_t height, const struct pixel_format *fmt, const struct region *damage);
+
+/* Draw the parts of snap inside repaint into dst (XRGB8888, alpha byte
+ * undefined). write_combined selects streaming stores for solid and opaque
+ * spans, for a dst that is an uncached mapping. Draw records are clipped to
+ * what their stores hold. */
+void scene_composite(struct scene_snapshot *snap, struct tile_list *tl, void *dst, uint32_t pitch,
+                     const struct region *repaint, int write_combined);
+
+#endif
@@ -0,0 +1,65 @@
+#include "slab.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Each chunk starts with a link to the next chunk, followed by the objects */
+struct slab_chunk {
+    struct slab_chunk *next;
+    max_align_t objs[];
+};
+
+void slab_init(struct slab *sl, size_t obj_size, size_t objs_per_chunk) {
+    size_t align = _Alignof(max_align_t);
+    if (obj_size < sizeof(void *)) obj_size = sizeof(void *);
+    sl->obj_size = (obj_size + align - 1) & ~(align - 1);
+    sl->objs_per_chunk = objs_per_chunk ? objs_per_chunk : 1;
+    sl->free_list = NULL;
+    sl->chunks = NULL;
+    sl->live = 0;
+}
+
+void slab_fini(struct slab *sl) {
+    struct slab_chunk *c = sl->chunks;
+    while (c) {
+        struct slab_chunk *next = c->next;
+        free(c);
+        c = next;
+    }
+    sl->chunks = NULL;
+    sl->free_list = NULL;
+    sl->live = 0;
+}
+
+static int slab_grow(struct slab *sl) {
+    struct slab_chunk *c = malloc(sizeof(*c) + sl->obj_size * sl->objs_per_chunk);
+    if (!c) return -1;
+    c->next = sl->chunks;
+    sl->chunks = c;
+
+    /* thread the new objects onto the free list */
+    uint8_t *base = (uint8_t *)c->objs;
+    for (size_t i = sl->objs_per_chunk; i-- > 0;) {
+        void **obj = (void **)(base + i * sl->obj_size);
+        *obj = sl->free_list;
+        sl->free_list = obj;
+    }
+    return 0;
+}
+
+void *slab_alloc(struct slab *sl) {
+    if (!sl->free_list && slab_grow(sl) != 0) return NULL;
+    void **obj = sl->free_list;
+    sl->free_list = *obj;
+    sl->live++;
+    memset(obj, 0, sl->obj_size);
+    return obj;
+}
+
+void slab_free(struct slab *sl, void *obj) {
+    if (!obj) return;
+    *(void **)obj = sl->free_list;
+    sl->free_list = obj;
+    sl->live--;
+}
@@ -0,0 +1,25 @@
+#ifndef ARGUS_SLAB_H
+#define ARGUS_SLAB_H
+
+#include <stddef.h>
+
+/* Fixed-size object allocator: objects are carved out of malloc'd chunks
+ * and recycled through an intrusive free list, so alloc and free are O(1)
+ * and the only limit is memory. Chunks are released by slab_fini().
+ */
+struct slab {
+    size_t obj_size;
+    size_t objs_per_chunk;
+    void *free_list;
+    void *chunks;
+    size_t live; /* objects currently handed out */
+};
+
+void slab_init(struct slab *sl, size_t obj_size, size_t objs_per_chunk);
+void slab_fini(struct slab *sl);
+
+/* Returns a zeroed object, or NULL if out of memory */
+void *slab_alloc(struct slab *sl);
+void slab_free(struct slab *sl, void *obj);
+
+#endif
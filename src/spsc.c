@@ -0,0 +1,41 @@
+#include "spsc.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+int spsc_init(struct spsc *q, size_t elem_size, uint32_t capacity) {
+    uint32_t cap = 1;
+    while (cap < capacity) cap <<= 1;
+    q->buf = calloc(cap, elem_size);
+    if (!q->buf) return -1;
+    q->elem_size = elem_size;
+    q->mask = cap - 1;
+    atomic_init(&q->head, 0);
+    atomic_init(&q->tail, 0);
+    return 0;
+}
+
+void spsc_fini(struct spsc *q) {
+    free(q->buf);
+    q->buf = NULL;
+}
+
+int spsc_push(struct spsc *q, const void *elem) {
+    unsigned tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    unsigned head = atomic_load_explicit(&q->head, memory_order_acquire);
+    if (tail - head > q->mask) return -1;
+    memcpy(q->buf + (size_t)(tail & q->mask) * q->elem_size, elem, q->elem_size);
+    /* publish the element before the new tail */
+    atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+    return 0;
+}
+
+int spsc_pop(struct spsc *q, void *elem) {
+    unsigned head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    unsigned tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+    if (head == tail) return 0;
+    memcpy(elem, q->buf + (size_t)(head & q->mask) * q->elem_size, q->elem_size);
+    /* the slot may be reused once head moves past it */
+    atomic_store_explicit(&q->head, head + 1, memory_order_release);
+    return 1;
+}
@@ -0,0 +1,31 @@
+#ifndef ARGUS_SPSC_H
+#define ARGUS_SPSC_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Bounded lock-free queue of fixed-size elements between exactly one
+ * producer thread and one consumer thread. Elements are copied in and out;
+ * head and tail sit on separate cache lines so the two sides only share a
+ * line when the queue is nearly empty or full. Neither side ever blocks:
+ * spsc_push() fails when the queue is full and spsc_pop() when it is empty.
+ */
+struct spsc {
+    uint8_t *buf;
+    size_t elem_size;
+    uint32_t mask; /* capacity - 1 */
+    _Alignas(64) atomic_uint head; /* next to pop, written by the consumer */
+    _Alignas(64) atomic_uint tail; /* next to push, written by the producer */
+};
+
+/* capacity is rounded up to a power of two. Returns -1 if out of memory. */
+int spsc_init(struct spsc *q, size_t elem_size, uint32_t capacity);
+void spsc_fini(struct spsc *q);
+
+/* Returns 0, or -1 if the queue is full */
+int spsc_push(struct spsc *q, const void *elem);
+/* Returns 1 and fills elem, or 0 if the queue is empty */
+int spsc_pop(struct spsc *q, void *elem);
+
+#endif
@@ -0,0 +1,166 @@
+#include "stream.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define STREAM_X86 1
+#endif
+
+#define PREFETCH_AHEAD 512 /* bytes of source prefetched ahead of the copy */
+#define STREAM_MIN 256 /* below this the setup costs more than it saves */
+
+static void copy_plain(void *dst, const void *src, size_t n) {
+    memcpy(dst, src, n);
+}
+
+static void fill_plain(uint32_t *dst, uint32_t value, size_t n) {
+    for (size_t i = 0; i < n; ++i) dst[i] = value;
+}
+
+#ifdef STREAM_X86
+
+/* Bytes from p to the next multiple of align (a power of two) */
+static inline size_t head_bytes(const void *p, size_t align) {
+    return (align - ((uintptr_t)p & (align - 1))) & (align - 1);
+}
+
+__attribute__((target("sse2")))
+static void copy_sse2(void *dst, const void *src, size_t n) {
+    uint8_t *d = dst;
+    const uint8_t *s = src;
+    size_t head = head_bytes(d, 16);
+    if (n < STREAM_MIN || head > n) {
+        memcpy(d, s, n);
+        return;
+    }
+    memcpy(d, s, head);
+    d += head; s += head; n -= head;
+
+    for (; n >= 64; d += 64, s += 64, n -= 64) {
+        _mm_prefetch((const char *)s + PREFETCH_AHEAD, _MM_HINT_NTA);
+        __m128i a = _mm_loadu_si128((const __m128i *)s);
+        __m128i b = _mm_loadu_si128((const __m128i *)(s + 16));
+        __m128i c = _mm_loadu_si128((const __m128i *)(s + 32));
+        __m128i e = _mm_loadu_si128((const __m128i *)(s + 48));
+        _mm_stream_si128((__m128i *)d, a);
+        _mm_stream_si128((__m128i *)(d + 16), b);
+        _mm_stream_si128((__m128i *)(d + 32), c);
+        _mm_stream_si128((__m128i *)(d + 48), e);
+    }
+    for (; n >= 16; d += 16, s += 16, n -= 16)
+        _mm_stream_si128((__m128i *)d, _mm_loadu_si128((const __m128i *)s));
+    memcpy(d, s, n);
+}
+
+__attribute__((target("avx")))
+static void copy_avx(void *dst, const void *src, size_t n) {
+    uint8_t *d = dst;
+    const uint8_t *s = src;
+    size_t head = head_bytes(d, 32);
+    if (n < STREAM_MIN || head > n) {
+        memcpy(d, s, n);
+        return;
+    }
+    memcpy(d, s, head);
+    d += head; s += head; n -= head;
+
+    for (; n >= 64; d += 64, s += 64, n -= 64) {
+        _mm_prefetch((const char *)s + PREFETCH_AHEAD, _MM_HINT_NTA);
+        __m256i a = _mm256_loadu_si256((const __m256i *)s);
+        __m256i b = _mm256_loadu_si256((const __m256i *)(s + 32));
+        _mm256_stream_si256((__m256i *)d, a);
+        _mm256_stream_si256((__m256i *)(d + 32), b);
+    }
+    for (; n >= 32; d += 32, s += 32, n -= 32)
+        _mm256_stream_si256((__m256i *)d, _mm256_loadu_si256((const __m256i *)s));
+    memcpy(d, s, n);
+}
+
+__attribute__((target("sse2")))
+static void fill_sse2(uint32_t *dst, uint32_t value, size_t n) {
+    size_t head = head_bytes(dst, 16) / 4;
+    if (n * 4 < STREAM_MIN || head > n || ((uintptr_t)dst & 3)) {
+        fill_plain(dst, value, n);
+        return;
+    }
+    fill_plain(dst, value, head);
+    dst += head; n -= head;
+
+    const __m128i v = _mm_set1_epi32((int)value);
+    for (; n >= 16; dst += 16, n -= 16) {
+        _mm_stream_si128((__m128i *)dst, v);
+        _mm_stream_si128((__m128i *)(dst + 4), v);
+        _mm_stream_si128((__m128i *)(dst + 8), v);
+        _mm_stream_si128((__m128i *)(dst + 12), v);
+    }
+    for (; n >= 4; dst += 4, n -= 4) _mm_stream_si128((__m128i *)dst, v);
+    fill_plain(dst, value, n);
+}
+
+__attribute__((target("avx")))
+static void fill_avx(uint32_t *dst, uint32_t value, size_t n) {
+    size_t head = head_bytes(dst, 32) / 4;
+    if (n * 4 < STREAM_MIN || head > n || ((uintptr_t)dst & 3)) {
+        fill_plain(dst, value, n);
+        return;
+    }
+    fill_plain(dst, value, head);
+    dst += head; n -= head;
+
+    const __m256i v = _mm256_set1_epi32((int)value);
+    for (; n >= 16; dst += 16, n -= 16) {
+        _mm256_stream_si256((__m256i *)dst, v);
+        _mm256_stream_si256((__m256i *)(dst + 8), v);
+    }
+    for (; n >= 8; dst += 8, n -= 8) _mm256_stream_si256((__m256i *)dst, v);
+    fill_plain(dst, value, n);
+}
+
+#endif /* STREAM_X86 */
+
+static void (*copy_fn)(void *, const void *, size_t) = copy_plain;
+static void (*fill_fn)(uint32_t *, uint32_t, size_t) = fill_plain;
+
+void stream_init(void) {
+    const char *want = getenv("ARGUS_STREAM");
+    if (want && strcmp(want, "plain") == 0) {
+        copy_fn = copy_plain;
+        fill_fn = fill_plain;
+        printf("stream: using plain stores\n");
+        return;
+    }
+#ifdef STREAM_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx") && !(want && strcmp(want, "sse2") == 0)) {
+        copy_fn = copy_avx;
+        fill_fn = fill_avx;
+        printf("stream: using AVX non-temporal stores\n");
+        return;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        copy_fn = copy_sse2;
+        fill_fn = fill_sse2;
+        printf("stream: using SSE2 non-temporal stores\n");
+        return;
+    }
+    copy_fn = copy_plain;
+    fill_fn = fill_plain;
+#endif
+}
+
+void stream_copy(void *dst, const void *src, size_t n) {
+    copy_fn(dst, src, n);
+}
+
+void stream_fill32(uint32_t *dst, uint32_t value, size_t n) {
+    fill_fn(dst, value, n);
+}
+
+void stream_fence(void) {
+#ifdef STREAM_X86
+    _mm_sfence();
+#endif
+}
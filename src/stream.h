@@ -0,0 +1,26 @@
+#ifndef ARGUS_STREAM_H
+#define ARGUS_STREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Writes into write-combined memory (the dumb buffer mappings). Stores are
+ * non-temporal and aligned to the vector width, so the WC buffers fill
+ * sequentially and flush as whole bursts and the destination is never read
+ * or pulled into the cache; the source is prefetched ahead of the copy.
+ *
+ * Non-temporal stores are weakly ordered: call stream_fence() once a batch
+ * of writes is done and before the buffer is handed to the display.
+ * stream_init() selects the AVX (32-byte) or SSE2 (16-byte) variant.
+ */
+void stream_init(void);
+
+/* memcpy into WC memory */
+void stream_copy(void *dst, const void *src, size_t n);
+
+/* Fill n 32-bit pixels with value */
+void stream_fill32(uint32_t *dst, uint32_t value, size_t n);
+
+void stream_fence(void);
+
+#endif
@@ -0,0 +1,50 @@
+#include "swapchain.h"
+
+#include <stdlib.h>
+
+void swapchain_init(struct swapchain *sc) {
+    const char *env = getenv("ARGUS_SWAPCHAIN");
+    int n = env ? atoi(env) : SWAPCHAIN_DEFAULT_SLOTS;
+    if (n < SWAPCHAIN_MIN_SLOTS) n = SWAPCHAIN_MIN_SLOTS;
+    if (n > SWAPCHAIN_MAX_SLOTS) n = SWAPCHAIN_MAX_SLOTS;
+    *sc = (struct swapchain){.nslots = n};
+    for (int i = 0; i < SWAPCHAIN_DAMAGE_HISTORY; ++i) region_init(&sc->damage_history[i]);
+}
+
+int swapchain_acquire(const struct swapchain *sc) {
+    int best = -1;
+    for (int i = 0; i < sc->nslots; ++i) {
+        const struct swapchain_slot *sl = &sc->slots[i];
+        if (sl->state == SLOT_READY) return i;
+        if (sl->state != SLOT_FREE) continue;
+        if (best < 0 || (sl->age && (!sc->slots[best].age || sl->age < sc->slots[best].age)))
+            best = i;
+    }
+    return best;
+}
+
+void swapchain_repaint_region(const struct swapchain *sc, int idx, const struct region *damage, int32_t w,
+                              int32_t h, struct region *out) {
+    int age = sc->slots[idx].age;
+    region_init(out);
+    if (!damage || age == 0 || age - 1 > SWAPCHAIN_DAMAGE_HISTORY) {
+        region_add(out, 0, 0, w, h);
+        return;
+    }
+    region_union(out, damage);
+    for (int i = 0; i < age - 1; ++i) region_union(out, &sc->damage_history[i]);
+    region_clip(out, w, h);
+}
+
+void swapchain_drawn(struct swapchain *sc, int idx, const struct region *damage, int32_t w, int32_t h) {
+    for (int i = SWAPCHAIN_DAMAGE_HISTORY - 1; i > 0; --i) sc->damage_history[i] = sc->damage_history[i - 1];
+    region_init(&sc->damage_history[0]);
+    if (damage) region_union(&sc->damage_history[0], damage);
+    else region_add(&sc->damage_history[0], 0, 0, w, h);
+
+    for (int i = 0; i < sc->nslots; ++i) {
+        if (sc->slots[i].age) sc->slots[i].age++;
+    }
+    sc->slots[idx].age = 1;
+    sc->slots[idx].seq = ++sc->frame_seq;
+}
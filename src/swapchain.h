@@ -0,0 +1,69 @@
+#ifndef ARGUS_SWAPCHAIN_H
+#define ARGUS_SWAPCHAIN_H
+
+#include <stdint.h>
+
+#include "region.h"
+
+/* Swapchain bookkeeping shared by the backends, which keep the buffers
+ * themselves in arrays indexed like the slots here.
+ *
+ * Lifecycle of a slot:
+ * FREE -> (drawn) READY -> (flip queued) QUEUED -> (flip landed) SCANOUT -> FREE.
+ * Only one flip can be in flight, so a frame drawn meanwhile waits as
+ * READY; a newer frame replaces the READY one, which is never shown.
+ *
+ * The first nslots slots (ARGUS_SWAPCHAIN) are drawn into; a backend may
+ * use the direct slots after them for framebuffers it only flips in. A
+ * slot of age N is missing the damage of the last N-1 frames, which the
+ * damage history keeps, newest first, so only that is redrawn.
+ */
+#define SWAPCHAIN_MIN_SLOTS 2
+#define SWAPCHAIN_MAX_SLOTS 4
+#define SWAPCHAIN_DEFAULT_SLOTS 3
+
+/* One on screen, one queued and one ready, so one is always usable */
+#define SWAPCHAIN_DIRECT_SLOTS 3
+#define SWAPCHAIN_ALL_SLOTS (SWAPCHAIN_MAX_SLOTS + SWAPCHAIN_DIRECT_SLOTS)
+
+#define SWAPCHAIN_DAMAGE_HISTORY 4
+
+enum slot_state {
+    SLOT_FREE,
+    SLOT_READY,
+    SLOT_QUEUED,
+    SLOT_SCANOUT
+};
+
+struct swapchain_slot {
+    enum slot_state state;
+    int age; /* frames since this slot was last drawn (0 = contents undefined) */
+    uint64_t seq; /* frame number of the contents */
+};
+
+struct swapchain {
+    int nslots;
+    struct swapchain_slot slots[SWAPCHAIN_ALL_SLOTS]; /* drawn, then direct */
+    uint64_t frame_seq; /* last frame drawn or flipped in */
+    struct region damage_history[SWAPCHAIN_DAMAGE_HISTORY];
+};
+
+/* All slots free with undefined contents, nslots from ARGUS_SWAPCHAIN */
+void swapchain_init(struct swapchain *sc);
+
+/* Slot to draw the next frame into, or -1 if all are busy. A READY frame
+ * that has not been queued yet is simply replaced; otherwise the free slot
+ * with the most recent contents needs the least repainting. */
+int swapchain_acquire(const struct swapchain *sc);
+
+/* Region that must be redrawn in slot idx of a w x h output so it matches
+ * a frame whose own damage is `damage`: the frames it missed plus this
+ * one, or everything if its contents are unknown (or damage is NULL) */
+void swapchain_repaint_region(const struct swapchain *sc, int idx, const struct region *damage, int32_t w,
+                              int32_t h, struct region *out);
+
+/* Record that slot idx now holds the newest frame, whose damage is
+ * `damage` (NULL = the whole w x h output), and number it */
+void swapchain_drawn(struct swapchain *sc, int idx, const struct region *damage, int32_t w, int32_t h);
+
+#endif
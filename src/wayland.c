@@ -1,56 +1,161 @@
 #define _GNU_SOURCE
 #include "wayland.h"
-#include "drm_simple.h"
+#include "convert.h"
+#include "backend.h"
+#include "region.h"
+#include "render.h"
+#include "repaint.h"
+#include "scene.h"
+#include "slab.h"
 
 #include <wayland-server-core.h>
 #include <wayland-server-protocol.h>
+#include "presentation-time-protocol.h"
+#include "linux-dmabuf-unstable-v1-protocol.h"
+#include <drm/drm_fourcc.h>
+#include <linux/udmabuf.h>
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdint.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
 #include <unistd.h>
 #include <errno.h>
 #include <time.h>
 
 /* Config */
-#define MAX_BUFFERS 32
+#define BUFFER_SLAB_CHUNK 64
 #define MAX_POINTERS 16
 #define MAX_KEYBOARDS 8
+#define COMPOSITOR_VERSION 4
+#define SEAT_VERSION 5
+#define PRESENTATION_VERSION 1
+#define DMABUF_VERSION 4
+#define BACKGROUND_COLOR 0xff202020u
+#define CASCADE_STEP 32 /* offset between successively mapped surfaces */
+
+/* Mapping replaced by a resize while the render thread was reading it */
+struct shm_mapping {
+    void *map;
+    size_t size;
+    struct shm_mapping *next;
+};
 
-/* Fallback screen size used for cursor clamping if DRM dims aren't queried here */
-static const int FALLBACK_W = 1024;
-static const int FALLBACK_H = 768;
-
-/* Pool user data stored on wl_shm_pool resource */
-struct pool_user {
+/* Client memory pool. Referenced by its wl_shm_pool resource and by every
+ * buffer created from it; unmapped when the last reference goes. The mapping
+ * may move on resize, so buffers keep offsets rather than pointers.
+ * busy counts uploads from the pool in frames the render thread has not
+ * finished; until it drops to zero, mappings moved away by a resize stay
+ * on the retired list.
+ *
+ * A dmabuf buffer gets a pool of its own: a read-only mapping of the
+ * dmabuf, which is kept open (dmabuf_fd) so reads can be synced with the
+ * device. shm pools have dmabuf_fd -1.
+ *
+ * A shm pool whose fd is a memfd sealed against shrinking keeps it open
+ * (memfd), so its buffers can be turned into dmabufs through /dev/udmabuf
+ * and shown directly; other pools have memfd -1 and are only composited. */
+struct shm_pool {
     void *map;
     size_t size;
+    int refcount;
+    int busy;
+    int dmabuf_fd;
+    int memfd;
+    struct shm_mapping *retired;
 };
 
-/* Tracked shm buffer */
+/* Tracked shm buffer, allocated from buffer_slab and stored as user data on
+ * its wl_buffer resource */
 struct shm_buffer {
-    int used;
     struct wl_resource *buffer_res;
-    void *data;
+    struct shm_pool *pool;
     uint32_t width;
     uint32_t height;
     uint32_t stride;
-    uint32_t format;
+    uint32_t format; /* WL_SHM_FORMAT_*, for dmabufs too */
     off_t offset;
     size_t size;
+    uint32_t fb_id; /* backend framebuffer of a dmabuf or udmabuf, or 0 */
+    int udmabuf_tried; /* a shm buffer's import was attempted */
+
+    /* Uploads of this buffer in unfinished frames. While busy, release is
+     * deferred (release_wanted) and a destroyed buffer's record is kept
+     * (buffer_res == NULL) until the render thread is done. */
+    int busy;
+    int release_wanted;
 };
 
-static struct shm_buffer buffers[MAX_BUFFERS];
+static struct slab buffer_slab;
+
+/* Per-client bookkeeping, found again through the client's destroy listener */
+struct client_state {
+    struct wl_listener destroy;
+    size_t live_buffers;
+};
 
 /* Globals */
 static struct wl_display *display = NULL;
 static struct wl_event_loop *evloop = NULL;
 static const char *socket_name = NULL;
 
-/* Single compositor surface (simple single-surface compositor) */
-static struct wl_resource *g_surface_res = NULL;
+/* Surfaces shown on the outputs, composited on repaint. The outputs are
+ * laid out left to right in the order they appeared, top-aligned, and the
+ * scene spans them all. */
+static struct scene scene;
+static int32_t cascade_x = 0, cascade_y = 0;
+
+/* A backend output and its place in the layout.
+ *
+ * Commits only mark the outputs they touch dirty; each output repaints when
+ * its own repaint scheduler says (from its repaint timer, or an idle source
+ * once the current dispatch is done if that is now), paced by its own
+ * vblanks. A repaint snapshots the output's part of the scene into a
+ * render_frame for the render thread, one frame in flight per output:
+ * while one is, further commits accumulate and go out with the next.
+ *
+ * An output the backend removed leaves the layout at once but is kept
+ * (removed set) until its frame in flight comes back. */
+struct output {
+    struct wl_list link; /* outputs, by id */
+    uint32_t id;
+    int32_t x, y;
+    uint32_t width, height;
+    uint32_t refresh_mhz;
+    int removed;
+
+    struct region damage; /* output coordinates */
+    struct wl_event_source *repaint_idle;
+    struct wl_event_source *repaint_timer;
+    int repaint_timer_fd;
+    int repaint_timer_armed;
+    struct repaint_sched sched;
+    uint64_t repaint_begin_ns;
+    int repaint_pending;
+    int frame_in_flight;
+
+    /* frame_batch list, oldest first */
+    struct wl_list frame_batches;
+    /* scanout_hold list, oldest first */
+    struct wl_list scanout_holds;
+    /* Vblank counter of the last flip, widened from the kernel's 32 bits */
+    uint64_t last_msc;
+};
+
+static struct wl_list outputs;
+/* Direct scanout of fullscreen surfaces and overlay planes, unless
+ * ARGUS_SCANOUT=0 */
+static int scanout_enabled = 1;
+/* Counters of outputs that are gone, for wl_get_repaint_stats() */
+static struct repaint_stats removed_stats;
+static struct render_frame *next_frame = NULL; /* collects dead stores */
+/* /dev/udmabuf, opened on first use; -1 before, -2 if it cannot be */
+static int udmabuf_dev = -1;
 
 /* Pointer/keyboard resources lists */
 static struct wl_resource *pointer_resources[MAX_POINTERS];
@@ -59,105 +164,233 @@ static struct wl_resource *keyboard_resources[MAX_KEYBOARDS];
 static int keyboard_count = 0;
 
 /* Virtual cursor position */
-static double seat_cx = -1.0;
-static double seat_cy = -1.0;
-
-/* Helpers for buffer tracking */
-static struct shm_buffer *allocate_shm_buffer(void) {
-    for (int i = 0; i < MAX_BUFFERS; ++i) {
-        if (!buffers[i].used) {
-            buffers[i].used = 1;
-            buffers[i].buffer_res = NULL;
-            buffers[i].data = NULL;
-            buffers[i].width = buffers[i].height = buffers[i].stride = 0;
-            buffers[i].format = 0;
-            buffers[i].offset = 0;
-            buffers[i].size = 0;
-            return &buffers[i];
-        }
+static double seat_cx = 0.0;
+static double seat_cy = 0.0;
+
+/* Pointer focus: the topmost surface under the pointer, and the serial of
+ * the enter sent for it */
+static struct wl_resource *pointer_focus = NULL;
+static uint32_t pointer_enter_serial = 0;
+
+/* Surface currently shown on the hardware cursor plane, and the timer that
+ * paces cursor frame callbacks independently of output repaints */
+static struct wl_resource *cursor_surface_res = NULL;
+static struct wl_event_source *cursor_frame_timer = NULL;
+static int cursor_frame_armed = 0;
+
+static void seat_update_focus(void);
+
+/* Generic destructor request (wl_surface.destroy, wl_buffer.destroy, ...) */
+static void resource_destroy(struct wl_client *client, struct wl_resource *res) {
+    (void)client;
+    wl_resource_destroy(res);
+}
+
+/* Helpers for per-client state */
+static void client_state_destroy(struct wl_listener *listener, void *data) {
+    (void)data;
+    struct client_state *cs = wl_container_of(listener, cs, destroy);
+    free(cs);
+}
+
+/* Existing state for client, or NULL. Once the client starts being torn
+ * down its destroy listeners are gone, so this returns NULL from resource
+ * destructors run during disconnect. */
+static struct client_state *client_state_find(struct wl_client *client) {
+    struct wl_listener *l = wl_client_get_destroy_listener(client, client_state_destroy);
+    if (!l) return NULL;
+    struct client_state *cs = wl_container_of(l, cs, destroy);
+    return cs;
+}
+
+static struct client_state *client_state_get(struct wl_client *client) {
+    struct client_state *cs = client_state_find(client);
+    if (cs) return cs;
+    cs = calloc(1, sizeof(*cs));
+    if (!cs) return NULL;
+    cs->destroy.notify = client_state_destroy;
+    wl_client_add_destroy_listener(client, &cs->destroy);
+    return cs;
+}
+
+/* Helpers for pool and buffer tracking */
+static void shm_pool_unmap_retired(struct shm_pool *pool) {
+    while (pool->retired) {
+        struct shm_mapping *m = pool->retired;
+        pool->retired = m->next;
+        munmap(m->map, m->size);
+        free(m);
     }
-    return NULL;
 }
 
-static void free_shm_buffer_by_resource(struct wl_resource *res) {
-    if (!res) return;
-    for (int i = 0; i < MAX_BUFFERS; ++i) {
-        if (buffers[i].used && buffers[i].buffer_res == res) {
-            buffers[i].used = 0;
-            buffers[i].buffer_res = NULL;
-            buffers[i].data = NULL;
-            buffers[i].width = buffers[i].height = buffers[i].stride = 0;
-            buffers[i].format = 0;
-            buffers[i].offset = 0;
-            buffers[i].size = 0;
-            return;
-        }
+static void shm_pool_unref(struct shm_pool *pool) {
+    if (--pool->refcount > 0) return;
+    shm_pool_unmap_retired(pool);
+    munmap(pool->map, pool->size);
+    if (pool->dmabuf_fd >= 0) close(pool->dmabuf_fd);
+    if (pool->memfd >= 0) close(pool->memfd);
+    free(pool);
+}
+
+static void *shm_buffer_data(const struct shm_buffer *b) {
+    return (uint8_t *)b->pool->map + b->offset;
+}
+
+static void shm_buffer_free(struct shm_buffer *b) {
+    if (b->fb_id) backend->release_dmabuf(b->fb_id);
+    shm_pool_unref(b->pool);
+    slab_free(&buffer_slab, b);
+}
+
+static void shm_buffer_destroy(struct wl_resource *res) {
+    struct shm_buffer *b = wl_resource_get_user_data(res);
+    struct client_state *cs = client_state_find(wl_resource_get_client(res));
+    if (cs) cs->live_buffers--;
+    b->buffer_res = NULL;
+    if (b->busy) return; /* freed when its last frame is done */
+    shm_buffer_free(b);
+}
+
+/* The render thread is done with one upload from b */
+static void shm_buffer_unbusy(struct shm_buffer *b) {
+    struct shm_pool *pool = b->pool;
+    if (--pool->busy == 0) shm_pool_unmap_retired(pool);
+    if (--b->busy > 0) return;
+    if (!b->buffer_res) {
+        shm_buffer_free(b);
+        return;
     }
+    if (b->release_wanted) wl_buffer_send_release(b->buffer_res);
+    b->release_wanted = 0;
 }
 
 /* --- wl_shm pool / buffer handling --- */
 
-/* wl_shm_pool.create_buffer implementation (forwarded by generated binding) */
+/* Create the wl_buffer for an already validated area of pool, taking a
+ * pool reference. NULL if out of memory. */
+static struct shm_buffer *shm_buffer_create(struct wl_client *client, struct shm_pool *pool, uint32_t buffer_id,
+                                            off_t offset, uint32_t width, uint32_t height, uint32_t stride,
+                                            uint32_t format) {
+    struct client_state *cs = client_state_get(client);
+    struct shm_buffer *b = slab_alloc(&buffer_slab);
+    if (!cs || !b) {
+        slab_free(&buffer_slab, b);
+        return NULL;
+    }
+
+    b->pool = pool;
+    b->offset = offset;
+    b->size = pool->size - offset;
+    b->width = width;
+    b->height = height;
+    b->stride = stride;
+    b->format = format;
+    b->fb_id = 0;
+    b->udmabuf_tried = 0;
+    b->buffer_res = NULL;
+    b->busy = 0;
+    b->release_wanted = 0;
+
+    /* create the wl_buffer resource the client expects */
+    struct wl_resource *buf_res = wl_resource_create(client, &wl_buffer_interface, 1, buffer_id);
+    if (!buf_res) {
+        slab_free(&buffer_slab, b);
+        return NULL;
+    }
+
+    /* the record lives on the resource and is freed by its destructor */
+    b->buffer_res = buf_res;
+    pool->refcount++;
+    static const struct wl_buffer_interface buffer_impl = {
+        .destroy = resource_destroy
+    };
+    wl_resource_set_implementation(buf_res, &buffer_impl, b, shm_buffer_destroy);
+    cs->live_buffers++;
+    return b;
+}
+
+/* wl_shm_pool.create_buffer implementation */
 static void shm_pool_create_buffer(struct wl_client *client,
                                    struct wl_resource *pool_res,
+                                   uint32_t buffer_id,
                                    int32_t offset,
                                    int32_t width,
                                    int32_t height,
                                    int32_t stride,
-                                   uint32_t format,
-                                   uint32_t buffer_id) {
-    (void)client;
-    struct pool_user *pu = wl_resource_get_user_data(pool_res);
-    if (!pu) {
-        wl_resource_post_error(pool_res, WL_SHM_ERROR_INVALID_FD, "pool not initialized");
+                                   uint32_t format) {
+    struct shm_pool *pool = wl_resource_get_user_data(pool_res);
+
+    const struct pixel_format *fmt = pixel_format_lookup(format);
+    if (!fmt) {
+        wl_resource_post_error(pool_res, WL_SHM_ERROR_INVALID_FORMAT, "unsupported format %#x", format);
         return;
     }
 
-    if (offset < 0 || width <= 0 || height <= 0 || stride <= 0) {
+    if (offset < 0 || width <= 0 || height <= 0 || stride <= 0 ||
+        (uint64_t)stride < (uint64_t)width * fmt->bpp) {
         wl_resource_post_error(pool_res, WL_SHM_ERROR_INVALID_STRIDE, "invalid buffer dimensions");
         return;
     }
 
     size_t needed = (size_t)offset + (size_t)stride * (size_t)height;
-    if (needed > pu->size) {
+    if (needed > pool->size) {
         wl_resource_post_error(pool_res, WL_SHM_ERROR_INVALID_FD, "buffer out of pool bounds");
         return;
     }
 
-    struct shm_buffer *b = allocate_shm_buffer();
-    if (!b) {
+    if (!shm_buffer_create(client, pool, buffer_id, offset, (uint32_t)width, (uint32_t)height, (uint32_t)stride,
+                           format))
         wl_resource_post_no_memory(pool_res);
-        return;
-    }
+}
 
-    b->data = (uint8_t *)pu->map + offset;
-    b->offset = offset;
-    b->size = pu->size - offset;
-    b->width = (uint32_t)width;
-    b->height = (uint32_t)height;
-    b->stride = (uint32_t)stride;
-    b->format = format;
-    b->buffer_res = NULL;
+/* wl_shm_pool.resize: grow the mapping in place when the kernel can, moving
+ * it otherwise; buffers address it by offset so either is fine. A mapping
+ * the render thread may be reading is not moved but duplicated: the pages
+ * are mapped again at the new size and the old mapping retired. */
+static void shm_pool_resize(struct wl_client *client, struct wl_resource *pool_res, int32_t size) {
+    (void)client;
+    struct shm_pool *pool = wl_resource_get_user_data(pool_res);
 
-    /* create the wl_buffer resource the client expects */
-    struct wl_resource *buf_res = wl_resource_create(client, &wl_buffer_interface, 1, buffer_id);
-    if (!buf_res) {
-        b->used = 0;
-        wl_resource_post_no_memory(pool_res);
+    if (size <= 0 || (size_t)size < pool->size) {
+        wl_resource_post_error(pool_res, WL_SHM_ERROR_INVALID_FD, "shrinking pool invalid");
         return;
     }
+    if ((size_t)size == pool->size) return;
 
-    /* associate our tracking struct with the created wl_buffer resource */
-    b->buffer_res = buf_res;
-    wl_resource_set_user_data(buf_res, b);
+    void *map = mremap(pool->map, pool->size, (size_t)size, 0);
+    if (map == MAP_FAILED && pool->busy) {
+        struct shm_mapping *old = malloc(sizeof(*old));
+        if (!old) {
+            wl_resource_post_no_memory(pool_res);
+            return;
+        }
+        /* old_size 0 maps the same shared pages a second time */
+        map = mremap(pool->map, 0, (size_t)size, MREMAP_MAYMOVE);
+        if (map == MAP_FAILED) {
+            free(old);
+        } else {
+            old->map = pool->map;
+            old->size = pool->size;
+            old->next = pool->retired;
+            pool->retired = old;
+        }
+    } else if (map == MAP_FAILED) {
+        map = mremap(pool->map, pool->size, (size_t)size, MREMAP_MAYMOVE);
+    }
+    if (map == MAP_FAILED) {
+        wl_resource_post_error(pool_res, WL_SHM_ERROR_INVALID_FD, "mremap failed");
+        return;
+    }
+    pool->map = map;
+    pool->size = (size_t)size;
+}
 
-    /* ensure buffer destroy cleans our tracking */
-    wl_resource_set_implementation(buf_res, NULL, b, (wl_resource_destroy_func_t)free_shm_buffer_by_resource);
+static void shm_pool_resource_destroy(struct wl_resource *pool_res) {
+    shm_pool_unref(wl_resource_get_user_data(pool_res));
 }
 
 /* wl_shm.create_pool implementation: mmap provided fd and create a wl_shm_pool for client */
-static void shm_create_pool(struct wl_client *client, struct wl_resource *shm_res, int fd, int32_t size, uint32_t pool_id) {
-    (void)client;
+static void shm_create_pool(struct wl_client *client, struct wl_resource *shm_res, uint32_t pool_id, int32_t fd, int32_t size) {
     if (fd < 0 || size <= 0) {
         wl_resource_post_error(shm_res, WL_SHM_ERROR_INVALID_FD, "invalid fd/size");
         if (fd >= 0) close(fd);
@@ -170,116 +403,1128 @@ static void shm_create_pool(struct wl_client *client, struct wl_resource *shm_re
         close(fd);
         return;
     }
-    close(fd);
+    /* only a memfd that cannot shrink may back a udmabuf */
+    int seals = scanout_enabled ? fcntl(fd, F_GET_SEALS) : -1;
+    if (seals < 0 || !(seals & F_SEAL_SHRINK)) {
+        close(fd);
+        fd = -1;
+    }
 
-    struct pool_user *pu = calloc(1, sizeof(*pu));
-    if (!pu) {
+    struct shm_pool *pool = calloc(1, sizeof(*pool));
+    if (!pool) {
         munmap(map, (size_t)size);
+        if (fd >= 0) close(fd);
         wl_resource_post_no_memory(shm_res);
         return;
     }
-    pu->map = map;
-    pu->size = (size_t)size;
+    pool->map = map;
+    pool->size = (size_t)size;
+    pool->refcount = 1;
+    pool->dmabuf_fd = -1;
+    pool->memfd = fd;
 
-    struct wl_client *client_for_pool = wl_resource_get_client(shm_res);
-    struct wl_resource *pool_res = wl_resource_create(client_for_pool, &wl_shm_pool_interface, 1, pool_id);
+    struct wl_resource *pool_res = wl_resource_create(client, &wl_shm_pool_interface, 1, pool_id);
     if (!pool_res) {
-        munmap(map, (size_t)size);
-        free(pu);
+        shm_pool_unref(pool);
         wl_resource_post_no_memory(shm_res);
         return;
     }
 
-    wl_resource_set_user_data(pool_res, pu);
-    /* free pool_user on pool destroy */
-    wl_resource_set_implementation(pool_res, NULL, pu, (wl_resource_destroy_func_t)free);
+    static const struct wl_shm_pool_interface pool_impl = {
+        .create_buffer = shm_pool_create_buffer,
+        .destroy = resource_destroy,
+        .resize = shm_pool_resize
+    };
+    /* the resource's reference is dropped on pool destroy */
+    wl_resource_set_implementation(pool_res, &pool_impl, pool, shm_pool_resource_destroy);
+}
+
+/* --- wl_surface handling --- */
+
+enum surface_role {
+    SURFACE_ROLE_NONE,
+    SURFACE_ROLE_CURSOR, /* wl_pointer.set_cursor */
+};
+
+/* How an output repaint takes a surface's buffer */
+enum latch_mode {
+    LATCH_COMPOSITE,
+    LATCH_SCANOUT, /* shown as the frame */
+    LATCH_OVERLAY, /* proposed for an overlay plane */
+    LATCH_DEFERRED, /* left to the repaint of the output it could be shown directly on */
+};
+
+/* Per-surface state stored as user data on the wl_surface resource.
+ *
+ * State is double-buffered: attach, damage and frame requests only fill the
+ * pending_* fields, and wl_surface.commit folds those into the current
+ * state and marks the output dirty, without touching pixels. The repaint
+ * (once per frame) latches whatever is current then, so however often a
+ * client commits, its content is copied at most once per frame; buffers
+ * replaced before a repaint saw them are released unread. */
+struct surface {
+    struct wl_resource *resource;
+    struct wl_list link; /* surfaces */
+    enum surface_role role;
+    int32_t hot_x, hot_y; /* cursor hotspot */
+
+    /* Place in the scene. The repaint maps a role-less surface once it
+     * has a buffer committed and unmaps it once a null one is. */
+    struct scene_view view;
+    int has_buffer;
+    /* The view has been mapped, so submitted frames may use its store */
+    int was_mapped;
+    /* The view store lacks the current buffer, which was scanned out
+     * directly instead; the next composited latch copies all of it */
+    int store_stale;
+    /* How the repaint in progress takes the buffer */
+    enum latch_mode latch;
+
+    /* Buffer attached since the last commit (attach_pending set; NULL for
+     * a null attach) */
+    struct shm_buffer *pending_buffer;
+    int attach_pending;
+    struct wl_listener pending_buffer_destroy;
+
+    /* Current buffer. While buffer_held is set the client must not touch
+     * it; wl_buffer.release is sent as soon as the render thread has copied
+     * out the pixels committed with it (or it is replaced unread, or, if it
+     * was scanned out directly, once it is off the screen), after which it
+     * is only kept for its metadata until the next attach.
+     * buffer_committed marks content the repaint has not latched yet. */
+    struct shm_buffer *buffer;
+    int buffer_held;
+    int buffer_committed;
+    struct wl_listener buffer_destroy;
+
+    /* Damage requested since the last commit, and committed damage not
+     * yet repainted. Without scale or transform, surface and buffer
+     * coordinates coincide, so damage and damage_buffer share these. */
+    struct region pending_damage;
+    struct region damage;
+
+    /* wl_callback resources (linked via wl_resource_get_link), requested
+     * since the last commit and committed but not yet presented */
+    struct wl_list pending_frames;
+    struct wl_list frames;
+
+    /* wp_presentation_feedback resources, likewise. Committed feedback
+     * whose content is replaced before a repaint latched it is discarded. */
+    struct wl_list pending_feedback;
+    struct wl_list feedback;
+};
+
+static struct wl_list surfaces;
+
+/* Frame callbacks and presentation feedback taken by one repaint of an
+ * output, waiting for its frame `seq` (see backend.h) to reach the screen;
+ * seq is SEQ_UNKNOWN until the render thread has drawn the frame */
+#define SEQ_UNKNOWN UINT64_MAX
+
+struct frame_batch {
+    uint64_t seq;
+    struct wl_list callbacks;
+    struct wl_list feedback;
+    struct wl_list link; /* output.frame_batches */
+};
+
+/* Buffer scanned out directly, as a frame or on an overlay plane: the
+ * display reads it until a later frame than seq is on screen, so it stays
+ * busy until then */
+struct scanout_hold {
+    struct shm_buffer *buffer;
+    uint64_t seq;
+    struct wl_list link; /* output.scanout_holds */
+};
+
+/* How a frame reached the screen, for wp_presentation_feedback.presented */
+struct present_info {
+    uint64_t time_ns; /* CLOCK_MONOTONIC */
+    uint64_t msc; /* vblank counter */
+    uint32_t refresh_ns;
+    uint32_t flags; /* WP_PRESENTATION_FEEDBACK_KIND_* */
+};
+
+static void frame_callback_destroy_cb(struct wl_resource *callback_res) {
+    wl_list_remove(wl_resource_get_link(callback_res));
+}
+
+static void send_feedback_presented(struct wl_list *list, const struct present_info *pi) {
+    struct wl_resource *fb, *tmp;
+    uint64_t sec = pi->time_ns / 1000000000u;
+    wl_resource_for_each_safe(fb, tmp, list) {
+        wp_presentation_feedback_send_presented(fb, (uint32_t)(sec >> 32), (uint32_t)sec,
+                                                (uint32_t)(pi->time_ns % 1000000000u), pi->refresh_ns,
+                                                (uint32_t)(pi->msc >> 32), (uint32_t)pi->msc, pi->flags);
+        wl_resource_destroy(fb);
+    }
+}
+
+static void send_feedback_discarded(struct wl_list *list) {
+    struct wl_resource *fb, *tmp;
+    wl_resource_for_each_safe(fb, tmp, list) {
+        wp_presentation_feedback_send_discarded(fb);
+        wl_resource_destroy(fb);
+    }
+}
+
+static void destroy_frame_callbacks(struct wl_list *list) {
+    struct wl_resource *cb, *tmp;
+    wl_resource_for_each_safe(cb, tmp, list) wl_resource_destroy(cb);
 }
 
-/* Buffer destroy callback used when client destroys wl_buffer */
-static void wl_buffer_destroy_cb(struct wl_resource *buffer_res) {
-    free_shm_buffer_by_resource(buffer_res);
+/* Send wl_callback.done(time_ms) to every callback on list and destroy it */
+static void send_frame_callbacks(struct wl_list *list, uint32_t time_ms) {
+    struct wl_resource *cb, *tmp;
+    wl_resource_for_each_safe(cb, tmp, list) {
+        wl_callback_send_done(cb, time_ms);
+        wl_resource_destroy(cb);
+    }
 }
 
-/* --- wl_surface handling (single surface) --- */
+/* Fire the callbacks of every batch of o whose frame is on screen by now */
+static void complete_frame_batches(struct output *o, uint64_t shown_seq, const struct present_info *pi) {
+    struct frame_batch *fb, *tmp;
+    wl_list_for_each_safe(fb, tmp, &o->frame_batches, link) {
+        if (fb->seq > shown_seq) break;
+        send_frame_callbacks(&fb->callbacks, (uint32_t)(pi->time_ns / 1000000u));
+        send_feedback_presented(&fb->feedback, pi);
+        wl_list_remove(&fb->link);
+        free(fb);
+    }
+}
+
+/* Hand back the buffers of o no longer on screen */
+static void release_scanout_holds(struct output *o, uint64_t shown_seq) {
+    struct scanout_hold *h, *tmp;
+    wl_list_for_each_safe(h, tmp, &o->scanout_holds, link) {
+        if (h->seq >= shown_seq) break;
+        shm_buffer_unbusy(h->buffer);
+        wl_list_remove(&h->link);
+        free(h);
+    }
+}
+
+static void destroy_frame_batches(struct output *o) {
+    struct frame_batch *fb, *tmp;
+    wl_list_for_each_safe(fb, tmp, &o->frame_batches, link) {
+        destroy_frame_callbacks(&fb->callbacks);
+        destroy_frame_callbacks(&fb->feedback);
+        wl_list_remove(&fb->link);
+        free(fb);
+    }
+}
+
+/* The output went away with frames still waiting for it: their clients
+ * get their callbacks now, and the feedback is discarded */
+static void abandon_frame_batches(struct output *o, uint32_t time_ms) {
+    struct frame_batch *fb, *tmp;
+    wl_list_for_each_safe(fb, tmp, &o->frame_batches, link) {
+        send_frame_callbacks(&fb->callbacks, time_ms);
+        send_feedback_discarded(&fb->feedback);
+        wl_list_remove(&fb->link);
+        free(fb);
+    }
+}
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static uint32_t monotonic_time_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((ts.tv_sec * 1000) + (ts.tv_nsec / 1000000));
+}
+
+/* Hand the attached buffer back to the client if we still hold it, or as
+ * soon as the render thread stops reading it */
+static void surface_release_buffer(struct surface *surf) {
+    if (surf->buffer && surf->buffer_held) {
+        if (surf->buffer->busy) surf->buffer->release_wanted = 1;
+        else wl_buffer_send_release(surf->buffer->buffer_res);
+    }
+    surf->buffer_held = 0;
+    surf->buffer_committed = 0;
+}
+
+static void surface_buffer_destroy_notify(struct wl_listener *listener, void *data) {
+    (void)data;
+    struct surface *surf = wl_container_of(listener, surf, buffer_destroy);
+    wl_list_remove(&surf->buffer_destroy.link);
+    surf->buffer = NULL;
+    surf->buffer_held = 0;
+    surf->buffer_committed = 0;
+}
+
+static void surface_pending_buffer_destroy_notify(struct wl_listener *listener, void *data) {
+    (void)data;
+    struct surface *surf = wl_container_of(listener, surf, pending_buffer_destroy);
+    wl_list_remove(&surf->pending_buffer_destroy.link);
+    surf->pending_buffer = NULL;
+}
+
+static void surface_set_pending_buffer(struct surface *surf, struct shm_buffer *b) {
+    if (surf->pending_buffer == b) return;
+    if (surf->pending_buffer) wl_list_remove(&surf->pending_buffer_destroy.link);
+    surf->pending_buffer = b;
+    if (b) wl_resource_add_destroy_listener(b->buffer_res, &surf->pending_buffer_destroy);
+}
+
+static void surface_set_buffer(struct surface *surf, struct shm_buffer *b) {
+    if (surf->buffer != b) {
+        surface_release_buffer(surf);
+        if (surf->buffer) wl_list_remove(&surf->buffer_destroy.link);
+        surf->buffer = b;
+        if (b) wl_resource_add_destroy_listener(b->buffer_res, &surf->buffer_destroy);
+    }
+    surf->buffer_held = (b != NULL);
+    surf->buffer_committed = 0;
+}
 
 /* wl_surface.attach handler */
 static void wl_surface_attach_cb(struct wl_client *client, struct wl_resource *surface_res,
                                  struct wl_resource *buffer_res, int32_t x, int32_t y) {
     (void)client; (void)x; (void)y;
-    if (!surface_res) return;
+    struct surface *surf = wl_resource_get_user_data(surface_res);
+    if (!surf) return;
+
+    struct shm_buffer *b = NULL;
+    if (buffer_res) {
+        b = wl_resource_get_user_data(buffer_res);
+        if (!b) {
+            /* buffer has no user_data (unsupported creation path) */
+            fprintf(stderr, "Argus: attach received wl_buffer with no user_data\n");
+            return;
+        }
+    }
+    surface_set_pending_buffer(surf, b);
+    surf->attach_pending = 1;
+}
+
+/* wl_surface.set_buffer_transform / set_buffer_scale (v2, v3): buffers are
+ * always shown untransformed at scale 1 */
+static void wl_surface_set_buffer_param_cb(struct wl_client *client, struct wl_resource *surface_res, int32_t value) {
+    (void)client; (void)surface_res; (void)value;
+}
+
+/* wl_surface.damage / damage_buffer handler */
+static void wl_surface_damage_cb(struct wl_client *client, struct wl_resource *surface_res,
+                                 int32_t x, int32_t y, int32_t width, int32_t height) {
+    (void)client;
+    struct surface *surf = wl_resource_get_user_data(surface_res);
+    region_add(&surf->pending_damage, x, y, width, height);
+}
+
+/* wl_surface.frame handler: queue a callback for the next commit */
+static void wl_surface_frame_cb(struct wl_client *client, struct wl_resource *surface_res, uint32_t callback) {
+    struct surface *surf = wl_resource_get_user_data(surface_res);
+    struct wl_resource *cb = wl_resource_create(client, &wl_callback_interface, 1, callback);
+    if (!cb) {
+        wl_resource_post_no_memory(surface_res);
+        return;
+    }
+    wl_resource_set_implementation(cb, NULL, NULL, frame_callback_destroy_cb);
+    wl_list_insert(surf->pending_frames.prev, wl_resource_get_link(cb));
+}
+
+/* --- outputs --- */
+
+static struct rect output_box(const struct output *o) {
+    struct rect r = {o->x, o->y, o->x + (int32_t)o->width, o->y + (int32_t)o->height};
+    return r;
+}
+
+static int64_t overlap_area(const struct rect *a, const struct rect *b) {
+    int32_t x1 = a->x1 > b->x1 ? a->x1 : b->x1, y1 = a->y1 > b->y1 ? a->y1 : b->y1;
+    int32_t x2 = a->x2 < b->x2 ? a->x2 : b->x2, y2 = a->y2 < b->y2 ? a->y2 : b->y2;
+    return x1 < x2 && y1 < y2 ? (int64_t)(x2 - x1) * (y2 - y1) : 0;
+}
+
+/* Output with the given id, removed ones included, or NULL */
+static struct output *output_find(uint32_t id) {
+    struct output *o;
+    wl_list_for_each(o, &outputs, link) {
+        if (o->id == id) return o;
+    }
+    return NULL;
+}
+
+/* Output showing layout point (x, y), or NULL */
+static struct output *output_at(double x, double y) {
+    struct output *o;
+    wl_list_for_each(o, &outputs, link) {
+        if (o->removed) continue;
+        if (x >= o->x && x < o->x + (double)o->width && y >= o->y && y < o->y + (double)o->height) return o;
+    }
+    return NULL;
+}
+
+/* The output the pointer is on (the first one if it is off all of them) */
+static struct output *pointer_output(void) {
+    struct output *o = output_at(seat_cx, seat_cy);
+    if (o) return o;
+    wl_list_for_each(o, &outputs, link) {
+        if (!o->removed) return o;
+    }
+    return NULL;
+}
+
+/* Output showing most of the view, whose repaints pace its frame
+ * callbacks; NULL if it is on none */
+static struct output *view_primary_output(const struct scene_view *v) {
+    if (!v->mapped) return NULL;
+    struct rect box = {v->x, v->y, v->x + (int32_t)v->width, v->y + (int32_t)v->height};
+    struct output *o, *best = NULL;
+    int64_t best_area = 0;
+    wl_list_for_each(o, &outputs, link) {
+        if (o->removed) continue;
+        struct rect ob = output_box(o);
+        int64_t area = overlap_area(&box, &ob);
+        if (area > best_area) {
+            best_area = area;
+            best = o;
+        }
+    }
+    return best;
+}
+
+static void output_repaint(struct output *o);
+
+static void repaint_idle_cb(void *data) {
+    struct output *o = data;
+    o->repaint_idle = NULL;
+    output_repaint(o);
+}
+
+/* Mark the output dirty and make sure a repaint will run, at the latest
+ * start time that still makes its next vblank */
+static void schedule_output(struct output *o) {
+    o->repaint_pending = 1;
+    if (o->removed || o->repaint_idle || o->repaint_timer_armed || o->frame_in_flight || !render_running())
+        return;
+
+    uint64_t now = monotonic_ns();
+    uint64_t start = repaint_sched_start(&o->sched, now);
+    if (start > now && o->repaint_timer) {
+        struct itimerspec its = {
+            .it_value = {.tv_sec = (time_t)(start / 1000000000u), .tv_nsec = (long)(start % 1000000000u)},
+        };
+        if (timerfd_settime(o->repaint_timer_fd, TFD_TIMER_ABSTIME, &its, NULL) == 0) {
+            o->repaint_timer_armed = 1;
+            return;
+        }
+    }
+    o->repaint_idle = wl_event_loop_add_idle(evloop, repaint_idle_cb, o);
+}
+
+static int repaint_timer_cb(int fd, uint32_t mask, void *data) {
+    (void)mask;
+    struct output *o = data;
+    uint64_t expirations;
+    if (read(fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+        perror("Argus: repaint timer read");
+    o->repaint_timer_armed = 0;
+    output_repaint(o);
+    return 0;
+}
+
+/* Hand the scene damage to the outputs it falls on and schedule those
+ * (except skip, which is repainting right now) */
+static void flush_scene_damage(struct output *skip) {
+    struct region damage;
+    region_init(&damage);
+    scene_take_damage(&scene, &damage);
+    if (region_is_empty(&damage)) return;
+
+    struct output *o;
+    wl_list_for_each(o, &outputs, link) {
+        if (o->removed) continue;
+        struct region part = damage;
+        region_translate(&part, -o->x, -o->y);
+        region_clip(&part, (int32_t)o->width, (int32_t)o->height);
+        if (region_is_empty(&part)) continue;
+        region_union(&o->damage, &part);
+        if (o != skip) schedule_output(o);
+    }
+}
+
+/* Schedule every output the surface's view is on; an unmapped surface
+ * will be mapped on the pointer's output */
+static void schedule_surface_outputs(struct surface *surf) {
+    if (!surf->view.mapped) {
+        struct output *o = pointer_output();
+        if (o) schedule_output(o);
+        return;
+    }
+    struct rect box = {surf->view.x, surf->view.y, surf->view.x + (int32_t)surf->view.width,
+                       surf->view.y + (int32_t)surf->view.height};
+    struct output *o;
+    wl_list_for_each(o, &outputs, link) {
+        if (o->removed) continue;
+        struct rect ob = output_box(o);
+        if (overlap_area(&box, &ob) > 0) schedule_output(o);
+    }
+}
+
+/* Place the outputs left to right in id order and size the scene to
+ * match; everything is repainted */
+static void relayout(void) {
+    int32_t x = 0, h = 0;
+    struct output *o;
+    wl_list_for_each(o, &outputs, link) {
+        if (o->removed) continue;
+        o->x = x;
+        o->y = 0;
+        x += (int32_t)o->width;
+        if ((int32_t)o->height > h) h = (int32_t)o->height;
+    }
+    scene_set_size(&scene, x, h);
+    flush_scene_damage(NULL);
+}
+
+static void output_destroy(struct output *o) {
+    abandon_frame_batches(o, monotonic_time_ms());
+    release_scanout_holds(o, UINT64_MAX);
+    if (o->repaint_idle) wl_event_source_remove(o->repaint_idle);
+    if (o->repaint_timer) wl_event_source_remove(o->repaint_timer);
+    if (o->repaint_timer_fd >= 0) close(o->repaint_timer_fd);
+
+    /* fold its counters into the totals */
+    const struct repaint_stats *st = &o->sched.stats;
+    removed_stats.frames += st->frames;
+    removed_stats.missed += st->missed;
+    removed_stats.late += st->late;
+    removed_stats.bypassed += st->bypassed;
+    removed_stats.overlaid += st->overlaid;
+    if (st->budget_ns > removed_stats.budget_ns) removed_stats.budget_ns = st->budget_ns;
+
+    wl_list_remove(&o->link);
+    free(o);
+}
+
+static void output_added(const struct backend_output_info *info) {
+    struct output *o = calloc(1, sizeof(*o));
+    if (!o) {
+        fprintf(stderr, "Argus: out of memory for output %s\n", info->name);
+        return;
+    }
+    int first = (pointer_output() == NULL);
+    o->id = info->id;
+    o->width = info->width;
+    o->height = info->height;
+    o->refresh_mhz = info->refresh_mhz;
+    region_init(&o->damage);
+    wl_list_init(&o->frame_batches);
+    wl_list_init(&o->scanout_holds);
+    repaint_sched_init(&o->sched, info->refresh_mhz ? 1000000000000ull / info->refresh_mhz : 16666667u);
+
+    /* the repaint window needs sub-millisecond wakeups, finer than
+     * wl_event_loop timers */
+    o->repaint_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (o->repaint_timer_fd >= 0)
+        o->repaint_timer = wl_event_loop_add_fd(evloop, o->repaint_timer_fd, WL_EVENT_READABLE, repaint_timer_cb, o);
+    if (!o->repaint_timer)
+        fprintf(stderr, "Argus: no repaint timer for %s, repainting immediately\n", info->name);
+
+    struct output *pos;
+    wl_list_for_each(pos, &outputs, link) {
+        if (pos->id > o->id) break;
+    }
+    wl_list_insert(pos->link.prev, &o->link);
+    printf("Argus: output %u %s %ux%u\n", o->id, info->name, o->width, o->height);
+
+    /* its first repaint lights it */
+    relayout();
+    if (first) {
+        seat_cx = o->x + o->width / 2.0;
+        seat_cy = o->y + o->height / 2.0;
+    }
+}
+
+static void output_removed(uint32_t id) {
+    struct output *o = output_find(id);
+    if (!o || o->removed) return;
+    printf("Argus: output %u removed\n", id);
+    o->removed = 1;
+    o->repaint_pending = 0;
+    if (o->repaint_idle) wl_event_source_remove(o->repaint_idle);
+    o->repaint_idle = NULL;
+    /* a frame still in flight comes back before the record goes */
+    if (!o->frame_in_flight) output_destroy(o);
+    relayout();
+
+    /* keep the pointer on what is left */
+    wl_seat_send_pointer_motion(0.0, 0.0);
+}
+
+/* Bring the surface's view up to date with its current state: map or
+ * unmap it, and follow the size and opacity of a newly committed buffer.
+ * New surfaces are cascaded on the pointer's output, or fill it if their
+ * buffer is its size. */
+static void surface_update_view(struct surface *surf) {
+    struct shm_buffer *b = surf->buffer;
+    if (surf->has_buffer && !surf->view.mapped) {
+        const struct output *o = pointer_output();
+        int32_t ox = o ? o->x : 0, oy = o ? o->y : 0;
+        int32_t ow = o ? (int32_t)o->width : scene.width, oh = o ? (int32_t)o->height : scene.height;
+        if (b && (int32_t)b->width == ow && (int32_t)b->height == oh) {
+            scene_view_move(&scene, &surf->view, ox, oy);
+        } else {
+            scene_view_move(&scene, &surf->view, ox + cascade_x, oy + cascade_y);
+            cascade_x += CASCADE_STEP;
+            cascade_y += CASCADE_STEP;
+            if (cascade_x > ow / 2 || cascade_y > oh / 2)
+                cascade_x = cascade_y = 0;
+        }
+        scene_view_map(&scene, &surf->view);
+        surf->was_mapped = 1;
+    } else if (!surf->has_buffer && surf->view.mapped) {
+        scene_view_unmap(&scene, &surf->view);
+    }
+
+    if (!b || !surf->buffer_committed || !surf->view.mapped) return;
+
+    /* validated at wl_shm_pool.create_buffer */
+    const struct pixel_format *fmt = pixel_format_lookup(b->format);
+    scene_view_set_opaque(&scene, &surf->view, fmt->opaque);
+
+    if (surf->view.width != b->width || surf->view.height != b->height) {
+        scene_view_resize(&scene, &surf->view, b->width, b->height);
+        region_init(&surf->damage);
+        region_add(&surf->damage, 0, 0, (int32_t)b->width, (int32_t)b->height);
+    }
+}
+
+/* Import a shm buffer as a backend framebuffer through a udmabuf of its
+ * pages, the first time it could be shown directly. Its pool must have
+ * kept its memfd and the buffer must start on a page; the udmabuf runs on
+ * to the next page boundary past its end. Returns whether b has a
+ * framebuffer, which dmabuf buffers have from the start if any. */
+static int shm_buffer_import_udmabuf(struct shm_buffer *b) {
+    if (b->fb_id || b->udmabuf_tried) return b->fb_id != 0;
+    b->udmabuf_tried = 1;
+    const struct shm_pool *pool = b->pool;
+    uint64_t page = (uint64_t)sysconf(_SC_PAGESIZE);
+    uint64_t size = ((uint64_t)b->stride * b->height + page - 1) / page * page;
+    struct stat st;
+    if (pool->memfd < 0 || (uint64_t)b->offset % page != 0 || fstat(pool->memfd, &st) != 0 ||
+        (uint64_t)b->offset + size > (uint64_t)st.st_size)
+        return 0;
+
+    if (udmabuf_dev == -1) {
+        udmabuf_dev = open("/dev/udmabuf", O_RDWR | O_CLOEXEC);
+        if (udmabuf_dev < 0) udmabuf_dev = -2;
+    }
+    if (udmabuf_dev < 0) return 0;
+    struct udmabuf_create create = {
+        .memfd = (uint32_t)pool->memfd,
+        .flags = UDMABUF_FLAGS_CLOEXEC,
+        .offset = (uint64_t)b->offset,
+        .size = size,
+    };
+    int fd = ioctl(udmabuf_dev, UDMABUF_CREATE, &create);
+    if (fd < 0) return 0;
+
+    /* composition does not need it, so a failed import is not an error */
+    struct backend_dmabuf buf = {
+        .width = (int32_t)b->width,
+        .height = (int32_t)b->height,
+        .format = pixel_format_lookup(b->format)->drm_format,
+        .modifier = DRM_FORMAT_MOD_INVALID,
+        .nplanes = 1,
+        .fd = {fd},
+        .stride = {b->stride},
+    };
+    if (backend->import_dmabuf(&buf, &b->fb_id) != 0) b->fb_id = 0;
+    close(fd);
+    return b->fb_id != 0;
+}
+
+/* Output the surface could be shown directly on: its buffer is an opaque
+ * dmabuf, or shm buffer turned into one, that the backend imported, with
+ * content the store lacks or still on screen, and its view lies within
+ * that output. NULL if there is none. */
+static struct output *surface_direct_output(struct surface *surf) {
+    struct shm_buffer *b = surf->buffer;
+    if (!scanout_enabled || surf->role != SURFACE_ROLE_NONE || !surf->view.mapped || !surf->view.opaque || !b ||
+        b->width != surf->view.width || b->height != surf->view.height ||
+        !(surf->buffer_committed || (surf->store_stale && b->busy)) || !shm_buffer_import_udmabuf(b))
+        return NULL;
+
+    struct rect box = {surf->view.x, surf->view.y, surf->view.x + (int32_t)surf->view.width,
+                       surf->view.y + (int32_t)surf->view.height};
+    struct output *o;
+    wl_list_for_each(o, &outputs, link) {
+        if (o->removed) continue;
+        struct rect ob = output_box(o);
+        if (box.x1 >= ob.x1 && box.y1 >= ob.y1 && box.x2 <= ob.x2 && box.y2 <= ob.y2) return o;
+    }
+    return NULL;
+}
+
+/* Decide how o's repaint takes each surface. One that could be shown
+ * directly on another output is left to that output. On o, the topmost
+ * view is scanned out as the frame if it covers o exactly; otherwise up to
+ * BACKEND_MAX_OVERLAYS views with nothing composited above them are
+ * proposed for overlay planes, and stored in overlays topmost first.
+ * Only opaque views qualify, so the planes never have to blend. Returns
+ * the number of overlay candidates. */
+static int choose_latch_modes(struct output *o, struct surface **overlays) {
+    struct surface *surf;
+    wl_list_for_each(surf, &surfaces, link) {
+        struct output *d = surface_direct_output(surf);
+        surf->latch = d && d != o ? LATCH_DEFERRED : LATCH_COMPOSITE;
+    }
+
+    struct rect ob = output_box(o);
+    struct region composited;
+    region_init(&composited);
+    int n = 0;
+    struct scene_view *v;
+    wl_list_for_each_reverse(v, &scene.views, link) {
+        if (!v->mapped) continue;
+        struct rect vb = {v->x, v->y, v->x + (int32_t)v->width, v->y + (int32_t)v->height};
+        if (overlap_area(&vb, &ob) == 0) continue;
+        surf = wl_container_of(v, surf, view);
+        if (surface_direct_output(surf) == o && !region_intersects(&composited, &vb)) {
+            if (n == 0 && vb.x1 == ob.x1 && vb.y1 == ob.y1 && vb.x2 == ob.x2 && vb.y2 == ob.y2) {
+                /* nothing else on o is visible */
+                surf->latch = LATCH_SCANOUT;
+                return 0;
+            }
+            if (n < BACKEND_MAX_OVERLAYS) {
+                surf->latch = LATCH_OVERLAY;
+                overlays[n++] = surf;
+                continue;
+            }
+        }
+        region_add(&composited, vb.x1, vb.y1, (int32_t)v->width, (int32_t)v->height);
+    }
+    return n;
+}
 
-    if (!g_surface_res) {
-        g_surface_res = surface_res;
-        wl_resource_set_implementation(g_surface_res, NULL, NULL, (wl_resource_destroy_func_t)NULL);
+/* Add the damaged part of a newly committed buffer to the frame's uploads.
+ * The render thread copies the pixels out, after which the buffer can go
+ * back. A buffer scanned out or proposed for an overlay plane is shown
+ * directly instead; the upload, of all of it, is only the fallback for
+ * when it cannot be. An overlay candidate damages nothing: the render
+ * thread damages its box if it composites it after all. */
+static void surface_latch(struct surface *surf, struct render_frame *f, const struct output *o) {
+    struct shm_buffer *b = surf->buffer;
+    int direct = surf->latch == LATCH_SCANOUT || surf->latch == LATCH_OVERLAY;
+    if (!b || !surf->view.mapped) return;
+    if (!surf->buffer_committed && !direct && !surf->store_stale) return;
+
+    /* the store has none of it */
+    if (direct || surf->store_stale) {
+        region_init(&surf->damage);
+        region_add(&surf->damage, 0, 0, (int32_t)b->width, (int32_t)b->height);
     }
 
-    if (!buffer_res) {
-        wl_resource_set_user_data(surface_res, NULL);
+    struct render_upload *u = render_frame_add_upload(f);
+    if (!u) {
+        wl_resource_post_no_memory(surf->resource);
+        return;
+    }
+    u->store = surf->view.store;
+    u->data = shm_buffer_data(b);
+    u->stride = b->stride;
+    u->width = b->width;
+    u->height = b->height;
+    u->fmt = pixel_format_lookup(b->format);
+    u->damage = surf->damage;
+    u->sync_fd = b->pool->dmabuf_fd;
+    u->deferred = direct;
+    u->buffer = b;
+    b->busy++;
+    b->pool->busy++;
+    if (surf->latch != LATCH_OVERLAY) scene_view_damage(&scene, &surf->view, &surf->damage);
+
+    surf->store_stale = direct;
+    if (surf->latch == LATCH_SCANOUT) {
+        f->scanout_fb = b->fb_id;
+        f->scanout_upload = f->nuploads - 1;
+    } else if (surf->latch == LATCH_OVERLAY) {
+        int32_t x = surf->view.x - o->x, y = surf->view.y - o->y;
+        f->overlays[f->noverlays++] = (struct render_overlay){
+            .fb_id = b->fb_id,
+            .box = {x, y, x + (int32_t)b->width, y + (int32_t)b->height},
+            .store = surf->view.store,
+            .upload = f->nuploads - 1,
+        };
+    }
+}
+
+static struct render_frame *get_next_frame(void) {
+    if (!next_frame) next_frame = render_frame_create();
+    return next_frame;
+}
+
+/* Repaint output o. Every surface is latched, whichever output it is on,
+ * so one upload serves all outputs; the damage this causes elsewhere
+ * schedules those outputs. The exception is a surface that could be shown
+ * directly, which is left to its own output's repaint: on o, its buffer is
+ * shown as the frame, or proposed for an overlay plane, when it has new
+ * content (or is still held from the last such frame). */
+static void output_repaint(struct output *o) {
+    if (o->frame_in_flight || o->removed) return; /* its completion reschedules */
+    o->repaint_begin_ns = monotonic_ns();
+    repaint_sched_begin(&o->sched, o->repaint_begin_ns);
+
+    struct render_frame *f = get_next_frame();
+    if (!f) {
+        fprintf(stderr, "Argus: out of memory for a frame\n");
         return;
     }
+    next_frame = NULL;
+    o->repaint_pending = 0;
+    f->output = o->id;
+
+    struct surface *surf;
+    wl_list_for_each(surf, &surfaces, link) {
+        if (surf->role == SURFACE_ROLE_CURSOR) continue; /* not on this plane */
+        surface_update_view(surf);
+    }
+    struct surface *overlays[BACKEND_MAX_OVERLAYS];
+    int noverlays = choose_latch_modes(o, overlays);
+    wl_list_for_each(surf, &surfaces, link) {
+        if (surf->role == SURFACE_ROLE_CURSOR || surf->latch == LATCH_DEFERRED || surf->latch == LATCH_OVERLAY)
+            continue;
+        surface_latch(surf, f, o);
+    }
+    for (int i = 0; i < noverlays; ++i) surface_latch(overlays[i], f, o);
+    flush_scene_damage(o);
+    f->damage = o->damage;
+    region_init(&o->damage);
+    struct rect box = output_box(o);
+    if (scene_snapshot(&scene, &box, &f->snap) != 0)
+        fprintf(stderr, "Argus: out of memory for the scene snapshot\n");
+
+    /* Everything committed so far on this output is part of this frame;
+     * its callbacks fire when the frame is flipped on screen. Surfaces
+     * mostly on another output wait for that output's repaint. */
+    struct frame_batch *fb = calloc(1, sizeof(*fb));
+    if (fb) {
+        fb->seq = SEQ_UNKNOWN;
+        wl_list_init(&fb->callbacks);
+        wl_list_init(&fb->feedback);
+        wl_list_insert(o->frame_batches.prev, &fb->link);
+    }
+    f->user = fb;
+    wl_list_for_each(surf, &surfaces, link) {
+        if (surf->role == SURFACE_ROLE_CURSOR || surf->latch == LATCH_DEFERRED) continue;
+        /* released once the render thread has copied it, or once it is off
+         * the screen if scanned out (right away if it will never be shown) */
+        if (surf->buffer_committed) surface_release_buffer(surf);
+        region_init(&surf->damage);
+
+        struct output *primary = view_primary_output(&surf->view);
+        if (primary && primary != o) {
+            if (!wl_list_empty(&surf->frames) || !wl_list_empty(&surf->feedback))
+                schedule_output(primary);
+            continue;
+        }
+        if (fb) {
+            wl_list_insert_list(fb->callbacks.prev, &surf->frames);
+            wl_list_insert_list(fb->feedback.prev, &surf->feedback);
+        } else {
+            send_frame_callbacks(&surf->frames, monotonic_time_ms());
+            send_feedback_discarded(&surf->feedback);
+        }
+        wl_list_init(&surf->frames);
+        wl_list_init(&surf->feedback);
+    }
+
+    if (render_submit(f) == 0) o->frame_in_flight = 1;
+    else fprintf(stderr, "Argus: render queue full\n");
 
-    struct shm_buffer *b = wl_resource_get_user_data(buffer_res);
+    /* newly mapped surfaces may now be under the pointer */
+    seat_update_focus();
+}
+
+/* Upload a cursor surface's current buffer to the cursor plane, at most
+ * once per cursor frame tick. The pixels are copied out here, so the
+ * buffer goes straight back. */
+static void cursor_surface_update(struct surface *surf) {
+    struct shm_buffer *b = surf->buffer;
     if (!b) {
-        /* buffer has no user_data (unsupported creation path) */
-        fprintf(stderr, "Argus: attach received wl_buffer with no user_data\n");
+        backend->cursor_set_image(NULL, 0, 0, 0, 0, 0);
         return;
     }
+    if (!surf->buffer_committed) return;
+
+    if (b->format == WL_SHM_FORMAT_ARGB8888 || b->format == WL_SHM_FORMAT_XRGB8888)
+        backend->cursor_set_image(shm_buffer_data(b), b->stride, b->width, b->height, surf->hot_x, surf->hot_y);
+    else
+        fprintf(stderr, "Argus: unsupported cursor format %u\n", b->format);
+    surface_release_buffer(surf);
+    region_init(&surf->damage);
+}
 
-    /* ensure buffer destroy will free our tracking */
-    wl_resource_set_implementation(buffer_res, NULL, b, (wl_resource_destroy_func_t)wl_buffer_destroy_cb);
+/* Latch the cursor image and fire the frame callbacks of cursor surfaces;
+ * their content reaches the screen through the cursor plane, which has no
+ * flip events of its own, so they are paced at the refresh rate of the
+ * pointer's output instead */
+static int cursor_frame_timer_cb(void *data) {
+    (void)data;
+    cursor_frame_armed = 0;
+    const struct output *o = pointer_output();
+    uint32_t now = monotonic_time_ms();
+    struct surface *surf;
+    wl_list_for_each(surf, &surfaces, link) {
+        if (surf->role != SURFACE_ROLE_CURSOR) continue;
+        if (surf->resource == cursor_surface_res) cursor_surface_update(surf);
+        send_frame_callbacks(&surf->frames, now);
+        wl_list_init(&surf->frames);
+        /* shown on the next vblank, but timed by this timer */
+        struct present_info pi = {monotonic_ns(), o ? o->last_msc : 0, o ? (uint32_t)o->sched.refresh_ns : 0, 0};
+        send_feedback_presented(&surf->feedback, &pi);
+        wl_list_init(&surf->feedback);
+    }
+    return 0;
+}
 
-    /* attach buffer to surface user_data for commit */
-    wl_resource_set_user_data(surface_res, b);
+static void arm_cursor_frame_timer(void) {
+    if (cursor_frame_armed || !cursor_frame_timer) return;
+    const struct output *o = pointer_output();
+    uint32_t refresh_mhz = o ? o->refresh_mhz : 0;
+    int interval_ms = refresh_mhz ? (int)(1000000u / refresh_mhz) : 16;
+    if (interval_ms < 1) interval_ms = 1;
+    wl_event_source_timer_update(cursor_frame_timer, interval_ms);
+    cursor_frame_armed = 1;
 }
 
 /* wl_surface.commit handler */
 static void wl_surface_commit_cb(struct wl_client *client, struct wl_resource *surface_res) {
     (void)client;
-    struct shm_buffer *b = wl_resource_get_user_data(surface_res);
-    if (!b) return;
+    struct surface *surf = wl_resource_get_user_data(surface_res);
+
+    if (surf->attach_pending) {
+        struct shm_buffer *b = surf->pending_buffer;
+        /* a differently sized buffer invalidates everything it covers */
+        if (b && (!surf->buffer || surf->buffer->width != b->width || surf->buffer->height != b->height))
+            region_add(&surf->damage, 0, 0, (int32_t)b->width, (int32_t)b->height);
+        /* a current buffer not latched yet is released unread */
+        surface_set_buffer(surf, b);
+        surface_set_pending_buffer(surf, NULL);
+        surf->has_buffer = (b != NULL);
+        surf->attach_pending = 0;
+    }
 
-    /* Accept WL_SHM_FORMAT_XRGB8888 only */
-    if (b->format != WL_SHM_FORMAT_XRGB8888) {
-        fprintf(stderr, "Argus: unsupported shm format %u\n", b->format);
+    wl_list_insert_list(surf->frames.prev, &surf->pending_frames);
+    wl_list_init(&surf->pending_frames);
+
+    /* this content update supersedes one no repaint has latched */
+    send_feedback_discarded(&surf->feedback);
+    wl_list_insert_list(surf->feedback.prev, &surf->pending_feedback);
+    wl_list_init(&surf->pending_feedback);
+
+    region_union(&surf->damage, &surf->pending_damage);
+    region_init(&surf->pending_damage);
+    surf->buffer_committed = surf->buffer_held;
+
+    if (surf->role == SURFACE_ROLE_CURSOR) {
+        /* cursor updates bypass the output repaint entirely */
+        if (surface_res == cursor_surface_res || !wl_list_empty(&surf->frames)) arm_cursor_frame_timer();
+        return;
+    }
+
+    schedule_surface_outputs(surf);
+}
+
+/* The fallback upload of a direct scanout or overlay was applied after
+ * all, so the store of the surface still showing that buffer is current */
+static void scanout_fallback_applied(const struct render_upload *u) {
+    struct surface *surf;
+    wl_list_for_each(surf, &surfaces, link) {
+        if (surf->buffer == u->buffer && surf->view.store == u->store) surf->store_stale = 0;
+    }
+}
+
+/* What became of the buffer of deferred upload i of f */
+static enum render_scanout_result deferred_result(const struct render_frame *f, int i) {
+    if (i == f->scanout_upload) return f->scanout_result;
+    for (int j = 0; j < f->noverlays; ++j) {
+        if (f->overlays[j].upload == i) return f->overlays[j].result;
+    }
+    return RENDER_SCANOUT_SKIPPED;
+}
+
+/* The render thread is done with frame f of output o: hand back the
+ * buffers it read, holding on to those it scanned out, and learn which
+ * flip will show it */
+static void render_frame_done(struct output *o, struct render_frame *f, uint64_t present_seq, uint64_t done_ns,
+                              uint64_t scanout_seq) {
+    for (int i = 0; i < f->nuploads; ++i) {
+        const struct render_upload *u = &f->uploads[i];
+        enum render_scanout_result res = u->deferred ? deferred_result(f, i) : RENDER_SCANOUT_SKIPPED;
+        if (res == RENDER_SCANOUT_SHOWN && o && !o->removed) {
+            struct scanout_hold *h = malloc(sizeof(*h));
+            if (h) {
+                h->buffer = u->buffer;
+                h->seq = present_seq;
+                wl_list_insert(o->scanout_holds.prev, &h->link);
+                continue;
+            }
+            fprintf(stderr, "Argus: out of memory, releasing a buffer on screen\n");
+        } else if (res == RENDER_SCANOUT_COMPOSITED && u->store) {
+            scanout_fallback_applied(u);
+        }
+        shm_buffer_unbusy(u->buffer);
+    }
+    if (!o) {
+        render_frame_destroy(f);
+        return;
+    }
+    o->frame_in_flight = 0;
+    if (o->removed) {
+        /* its batches went with it */
+        render_frame_destroy(f);
+        output_destroy(o);
         return;
     }
 
-    if (drm_present_from_shm(b->data, b->stride, b->width, b->height) != 0) {
-        fprintf(stderr, "Argus: drm_present_from_shm failed\n");
+    repaint_sched_done(&o->sched, o->repaint_begin_ns, done_ns, present_seq);
+    if (f->scanout_result == RENDER_SCANOUT_SHOWN) o->sched.stats.bypassed++;
+    for (int i = 0; i < f->noverlays; ++i) {
+        if (f->overlays[i].result == RENDER_SCANOUT_SHOWN) o->sched.stats.overlaid++;
+    }
+    struct frame_batch *fb = f->user;
+    if (fb) fb->seq = present_seq;
+    render_frame_destroy(f);
+
+    /* batches of repaints that drew nothing complete here, already on
+     * screen: there is no flip to time them by */
+    struct present_info pi = {monotonic_ns(), o->last_msc, (uint32_t)o->sched.refresh_ns, 0};
+    complete_frame_batches(o, scanout_seq, &pi);
+    release_scanout_holds(o, scanout_seq);
+    if (o->repaint_pending) schedule_output(o);
+}
+
+/* Events from the render thread. A flip completion releases the frame
+ * callbacks of everything up to the frame now on that output's screen,
+ * with the flip timestamp. */
+static void render_event_cb(const struct render_event *ev, void *data) {
+    (void)data;
+    struct output *o = output_find(ev->output);
+    switch (ev->type) {
+    case RENDER_EVENT_DONE:
+        render_frame_done(o, ev->frame, ev->present_seq, ev->done_ns, ev->scanout_seq);
+        break;
+    case RENDER_EVENT_FLIP: {
+        if (!o || o->removed) break;
+        struct present_info pi = {
+            .time_ns = (uint64_t)ev->sec * 1000000000u + (uint64_t)ev->usec * 1000u,
+            .refresh_ns = (uint32_t)ev->refresh_ns,
+            .flags = WP_PRESENTATION_FEEDBACK_KIND_VSYNC | WP_PRESENTATION_FEEDBACK_KIND_HW_CLOCK |
+                     WP_PRESENTATION_FEEDBACK_KIND_HW_COMPLETION,
+        };
+        o->last_msc += (uint32_t)(ev->vblank - (uint32_t)o->last_msc);
+        pi.msc = o->last_msc;
+        repaint_sched_flip(&o->sched, pi.time_ns, ev->refresh_ns, ev->scanout_seq);
+        complete_frame_batches(o, ev->scanout_seq, &pi);
+        release_scanout_holds(o, ev->scanout_seq);
+        break;
+    }
+    case RENDER_EVENT_OUTPUT_ADDED:
+        output_added(&ev->info);
+        break;
+    case RENDER_EVENT_OUTPUT_REMOVED:
+        output_removed(ev->output);
+        break;
     }
 }
 
 /* surface destroy */
 static void wl_surface_destroy_cb(struct wl_resource *surface_res) {
-    if (g_surface_res == surface_res) g_surface_res = NULL;
+    struct surface *surf = wl_resource_get_user_data(surface_res);
+    if (cursor_surface_res == surface_res) {
+        cursor_surface_res = NULL;
+        backend->cursor_set_image(NULL, 0, 0, 0, 0, 0);
+    }
+    if (!surf) return;
+    struct view_store *store = surf->view.store;
+    scene_view_fini(&scene, &surf->view);
+    if (!render_running() || !surf->was_mapped) {
+        /* no frame the render thread has can reference it */
+        view_store_destroy(store);
+    } else if (get_next_frame() && render_frame_add_dead(next_frame, store) == 0) {
+        /* frames in flight may still draw from it; the render thread
+         * frees it once they are done, after the next repaint */
+        flush_scene_damage(NULL);
+    } else {
+        fprintf(stderr, "Argus: out of memory, leaking a view store\n");
+    }
+    if (pointer_focus == surface_res) {
+        pointer_focus = NULL;
+        seat_update_focus();
+    }
+
+    surface_set_pending_buffer(surf, NULL);
+    surface_set_buffer(surf, NULL);
+    destroy_frame_callbacks(&surf->pending_frames);
+    destroy_frame_callbacks(&surf->frames);
+    send_feedback_discarded(&surf->pending_feedback);
+    send_feedback_discarded(&surf->feedback);
+    wl_list_remove(&surf->link);
+    free(surf);
 }
 
 /* --- compositor bind / create_surface --- */
 
 static void compositor_create_surface(struct wl_client *client, struct wl_resource *resource, uint32_t id) {
-    (void)resource;
-    struct wl_resource *surf = wl_resource_create(client, &wl_surface_interface, 1, id);
-    if (!surf) return;
+    struct surface *surf = calloc(1, sizeof(*surf));
+    struct view_store *store = view_store_create();
+    if (!surf || !store) {
+        free(surf);
+        view_store_destroy(store);
+        wl_resource_post_no_memory(resource);
+        return;
+    }
+
+    struct wl_resource *res = wl_resource_create(client, &wl_surface_interface,
+                                                 wl_resource_get_version(resource), id);
+    if (!res) {
+        free(surf);
+        view_store_destroy(store);
+        wl_resource_post_no_memory(resource);
+        return;
+    }
+
+    surf->resource = res;
+    scene_view_init(&surf->view, store);
+    surf->buffer_destroy.notify = surface_buffer_destroy_notify;
+    surf->pending_buffer_destroy.notify = surface_pending_buffer_destroy_notify;
+    wl_list_init(&surf->pending_frames);
+    wl_list_init(&surf->frames);
+    wl_list_init(&surf->pending_feedback);
+    wl_list_init(&surf->feedback);
+    region_init(&surf->pending_damage);
+    region_init(&surf->damage);
+    wl_list_insert(surfaces.prev, &surf->link);
 
     static const struct wl_surface_interface surf_impl = {
-        .destroy = NULL,
+        .destroy = resource_destroy,
         .attach = wl_surface_attach_cb,
-        .damage = NULL,
-        .frame = NULL,
+        .damage = wl_surface_damage_cb,
+        .frame = wl_surface_frame_cb,
         .set_opaque_region = NULL,
         .set_input_region = NULL,
         .commit = wl_surface_commit_cb,
-        .set_buffer_transform = NULL,
-        .set_buffer_scale = NULL,
-        .damage_buffer = NULL
+        .set_buffer_transform = wl_surface_set_buffer_param_cb,
+        .set_buffer_scale = wl_surface_set_buffer_param_cb,
+        .damage_buffer = wl_surface_damage_cb
     };
 
-    wl_resource_set_implementation(surf, &surf_impl, NULL, (wl_resource_destroy_func_t)wl_surface_destroy_cb);
+    wl_resource_set_implementation(res, &surf_impl, surf, (wl_resource_destroy_func_t)wl_surface_destroy_cb);
 }
 
 static void compositor_bind(struct wl_client *client, void *data, uint32_t version, uint32_t id) {
-    (void)data; (void)version;
-    struct wl_resource *res = wl_resource_create(client, &wl_compositor_interface, 1, id);
+    (void)data;
+    struct wl_resource *res = wl_resource_create(client, &wl_compositor_interface, (int)version, id);
     if (!res) return;
 
     static const struct wl_compositor_interface comp_impl = {
@@ -297,119 +1542,594 @@ static void shm_bind(struct wl_client *client, void *data, uint32_t version, uin
     struct wl_resource *res = wl_resource_create(client, &wl_shm_interface, 1, id);
     if (!res) return;
 
-    /* cast to match generated prototype on this system */
     static const struct wl_shm_interface shm_impl = {
-        .create_pool = (void (*)(struct wl_client *, struct wl_resource *, uint32_t, int32_t, int32_t))shm_create_pool
+        .create_pool = shm_create_pool
     };
 
     wl_resource_set_implementation(res, &shm_impl, NULL, NULL);
+
+    for (size_t i = 0; i < pixel_format_count(); ++i)
+        wl_shm_send_format(res, pixel_format_at(i)->shm_format);
+}
+
+/* --- zwp_linux_dmabuf_v1 ---
+ *
+ * Client dmabufs are composited like shm buffers, from a read-only mapping,
+ * so only formats the converters know and the linear layout are taken:
+ * anything else could not be read by the CPU. Each buffer is also imported
+ * into the backend, which may scan it out directly. */
+
+/* Format table shared by every feedback object: sealed memfd of entries */
+struct dmabuf_table_entry {
+    uint32_t format;
+    uint32_t pad;
+    uint64_t modifier;
+};
+
+static int dmabuf_table_fd = -1;
+static uint32_t dmabuf_table_size = 0;
+
+/* zwp_linux_buffer_params_v1 state; plane fds are owned until used */
+struct dmabuf_params {
+    struct backend_dmabuf buf;
+    int used;
+};
+
+static int dmabuf_table_init(void) {
+    size_t n = pixel_format_count();
+    struct dmabuf_table_entry *table = calloc(n, sizeof(*table));
+    if (!table) return -1;
+    for (size_t i = 0; i < n; ++i) {
+        table[i].format = pixel_format_at(i)->drm_format;
+        table[i].modifier = DRM_FORMAT_MOD_LINEAR;
+    }
+    size_t size = n * sizeof(*table);
+
+    int fd = memfd_create("argus-dmabuf-formats", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0) {
+        free(table);
+        return -1;
+    }
+    ssize_t w = write(fd, table, size);
+    free(table);
+    /* clients map it themselves, so it must never change */
+    if (w != (ssize_t)size ||
+        fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) != 0) {
+        close(fd);
+        return -1;
+    }
+    dmabuf_table_fd = fd;
+    dmabuf_table_size = (uint32_t)size;
+    return 0;
+}
+
+static void dmabuf_params_resource_destroy(struct wl_resource *res) {
+    struct dmabuf_params *p = wl_resource_get_user_data(res);
+    for (int i = 0; i < BACKEND_DMABUF_MAX_PLANES; ++i) {
+        if (p->buf.fd[i] >= 0) close(p->buf.fd[i]);
+    }
+    free(p);
+}
+
+/* zwp_linux_buffer_params_v1.add */
+static void dmabuf_params_add(struct wl_client *client, struct wl_resource *res, int32_t fd, uint32_t plane_idx,
+                              uint32_t offset, uint32_t stride, uint32_t modifier_hi, uint32_t modifier_lo) {
+    (void)client;
+    struct dmabuf_params *p = wl_resource_get_user_data(res);
+    uint64_t modifier = (uint64_t)modifier_hi << 32 | modifier_lo;
+
+    if (p->used) {
+        wl_resource_post_error(res, ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_ALREADY_USED, "params already used");
+    } else if (plane_idx >= BACKEND_DMABUF_MAX_PLANES) {
+        wl_resource_post_error(res, ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_PLANE_IDX, "plane %u out of range", plane_idx);
+    } else if (p->buf.fd[plane_idx] >= 0) {
+        wl_resource_post_error(res, ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_PLANE_SET, "plane %u already set", plane_idx);
+    } else if (p->buf.nplanes > 0 && p->buf.modifier != modifier) {
+        wl_resource_post_error(res, ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_INVALID_FORMAT, "planes differ in modifier");
+    } else {
+        p->buf.fd[plane_idx] = fd;
+        p->buf.offset[plane_idx] = offset;
+        p->buf.stride[plane_idx] = stride;
+        p->buf.modifier = modifier;
+        p->buf.nplanes++;
+        return;
+    }
+    close(fd);
 }
 
-/* --- wl_seat implementation (pointer + keyboard broadcasting) --- */
+/* Validate and map the params' dmabuf and create its wl_buffer. Protocol
+ * errors are posted here; returns NULL with no error posted if the buffer
+ * is fine but cannot be used, which the caller reports its own way. */
+static struct shm_buffer *dmabuf_params_import(struct wl_client *client, struct wl_resource *res, uint32_t buffer_id,
+                                               int32_t width, int32_t height, uint32_t format, uint32_t flags,
+                                               int *error) {
+    struct dmabuf_params *p = wl_resource_get_user_data(res);
+    *error = 1;
+    if (p->used) {
+        wl_resource_post_error(res, ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_ALREADY_USED, "params already used");
+        return NULL;
+    }
+    p->used = 1;
+
+    /* every supported format has a single plane */
+    if (p->buf.fd[0] < 0 || p->buf.nplanes != 1) {
+        wl_resource_post_error(res, ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_INCOMPLETE, "format %#x takes one plane",
+                               format);
+        return NULL;
+    }
+    if (width <= 0 || height <= 0) {
+        wl_resource_post_error(res, ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_INVALID_DIMENSIONS, "invalid size %dx%d",
+                               width, height);
+        return NULL;
+    }
+    const struct pixel_format *fmt = pixel_format_lookup_drm(format);
+    if (!fmt || (p->buf.modifier != DRM_FORMAT_MOD_LINEAR && p->buf.modifier != DRM_FORMAT_MOD_INVALID)) {
+        wl_resource_post_error(res, ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_INVALID_FORMAT,
+                               "unsupported format %#x modifier %#llx", format,
+                               (unsigned long long)p->buf.modifier);
+        return NULL;
+    }
+
+    int fd = p->buf.fd[0];
+    uint64_t offset = p->buf.offset[0], stride = p->buf.stride[0];
+    off_t size = lseek(fd, 0, SEEK_END);
+    if (stride < (uint64_t)width * fmt->bpp ||
+        (size >= 0 && offset + stride * (uint64_t)height > (uint64_t)size)) {
+        wl_resource_post_error(res, ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_OUT_OF_BOUNDS, "plane 0 out of bounds");
+        return NULL;
+    }
+
+    *error = 0;
+    if (size <= 0 || flags != 0) return NULL;
+    void *map = mmap(NULL, (size_t)size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) return NULL;
+
+    struct shm_pool *pool = calloc(1, sizeof(*pool));
+    if (!pool) {
+        munmap(map, (size_t)size);
+        return NULL;
+    }
+    pool->map = map;
+    pool->size = (size_t)size;
+    pool->refcount = 1;
+    pool->dmabuf_fd = fd;
+    pool->memfd = -1;
+    p->buf.fd[0] = -1;
+
+    struct shm_buffer *b = shm_buffer_create(client, pool, buffer_id, (off_t)offset, (uint32_t)width,
+                                             (uint32_t)height, (uint32_t)stride, fmt->shm_format);
+    shm_pool_unref(pool); /* the buffer holds it now */
+    if (!b) {
+        wl_resource_post_no_memory(res);
+        *error = 1;
+        return NULL;
+    }
+
+    /* composition does not need it, so a failed import is not an error */
+    p->buf.width = width;
+    p->buf.height = height;
+    p->buf.format = format;
+    p->buf.fd[0] = pool->dmabuf_fd;
+    if (backend->import_dmabuf(&p->buf, &b->fb_id) != 0) b->fb_id = 0;
+    p->buf.fd[0] = -1;
+    return b;
+}
 
-/* pointer and keyboard implementations (release only) */
-static void pointer_release(struct wl_client *client, struct wl_resource *res) {
-    (void)client; (void)res;
+/* zwp_linux_buffer_params_v1.create: the buffer is announced by an event */
+static void dmabuf_params_create(struct wl_client *client, struct wl_resource *res, int32_t width, int32_t height,
+                                 uint32_t format, uint32_t flags) {
+    int error;
+    struct shm_buffer *b = dmabuf_params_import(client, res, 0, width, height, format, flags, &error);
+    if (b)
+        zwp_linux_buffer_params_v1_send_created(res, b->buffer_res);
+    else if (!error)
+        zwp_linux_buffer_params_v1_send_failed(res);
 }
-static void keyboard_release(struct wl_client *client, struct wl_resource *res) {
-    (void)client; (void)res;
+
+/* zwp_linux_buffer_params_v1.create_immed: the client named the buffer, so
+ * failing to import it is fatal */
+static void dmabuf_params_create_immed(struct wl_client *client, struct wl_resource *res, uint32_t buffer_id,
+                                       int32_t width, int32_t height, uint32_t format, uint32_t flags) {
+    int error;
+    struct shm_buffer *b = dmabuf_params_import(client, res, buffer_id, width, height, format, flags, &error);
+    if (!b && !error)
+        wl_resource_post_error(res, ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_INVALID_WL_BUFFER, "dmabuf import failed");
+}
+
+/* zwp_linux_dmabuf_v1.create_params */
+static void dmabuf_create_params(struct wl_client *client, struct wl_resource *res, uint32_t params_id) {
+    struct dmabuf_params *p = calloc(1, sizeof(*p));
+    struct wl_resource *params_res =
+        p ? wl_resource_create(client, &zwp_linux_buffer_params_v1_interface, wl_resource_get_version(res),
+                               params_id)
+          : NULL;
+    if (!params_res) {
+        free(p);
+        wl_resource_post_no_memory(res);
+        return;
+    }
+    for (int i = 0; i < BACKEND_DMABUF_MAX_PLANES; ++i) p->buf.fd[i] = -1;
+
+    static const struct zwp_linux_buffer_params_v1_interface params_impl = {
+        .destroy = resource_destroy,
+        .add = dmabuf_params_add,
+        .create = dmabuf_params_create,
+        .create_immed = dmabuf_params_create_immed
+    };
+    wl_resource_set_implementation(params_res, &params_impl, p, dmabuf_params_resource_destroy);
+}
+
+/* One tranche on the backend's device with every format. The same
+ * feedback serves each surface: nothing is preferred per surface yet. */
+static void dmabuf_feedback_create(struct wl_client *client, struct wl_resource *res, uint32_t id) {
+    struct wl_resource *fb = wl_resource_create(client, &zwp_linux_dmabuf_feedback_v1_interface,
+                                                wl_resource_get_version(res), id);
+    if (!fb) {
+        wl_resource_post_no_memory(res);
+        return;
+    }
+    static const struct zwp_linux_dmabuf_feedback_v1_interface feedback_impl = {
+        .destroy = resource_destroy
+    };
+    wl_resource_set_implementation(fb, &feedback_impl, NULL, NULL);
+
+    dev_t dev = backend->device();
+    struct wl_array device, indices;
+    wl_array_init(&device);
+    wl_array_init(&indices);
+    dev_t *d = wl_array_add(&device, sizeof(dev));
+    if (d) *d = dev;
+    for (size_t i = 0; i < pixel_format_count(); ++i) {
+        uint16_t *idx = wl_array_add(&indices, sizeof(*idx));
+        if (idx) *idx = (uint16_t)i;
+    }
+
+    zwp_linux_dmabuf_feedback_v1_send_format_table(fb, dmabuf_table_fd, dmabuf_table_size);
+    zwp_linux_dmabuf_feedback_v1_send_main_device(fb, &device);
+    zwp_linux_dmabuf_feedback_v1_send_tranche_target_device(fb, &device);
+    zwp_linux_dmabuf_feedback_v1_send_tranche_formats(fb, &indices);
+    zwp_linux_dmabuf_feedback_v1_send_tranche_flags(fb, 0);
+    zwp_linux_dmabuf_feedback_v1_send_tranche_done(fb);
+    zwp_linux_dmabuf_feedback_v1_send_done(fb);
+    wl_array_release(&device);
+    wl_array_release(&indices);
+}
+
+static void dmabuf_get_surface_feedback(struct wl_client *client, struct wl_resource *res, uint32_t id,
+                                        struct wl_resource *surface_res) {
+    (void)surface_res;
+    dmabuf_feedback_create(client, res, id);
+}
+
+/* Before v4 the formats are announced on bind instead of in feedback */
+static void dmabuf_bind(struct wl_client *client, void *data, uint32_t version, uint32_t id) {
+    (void)data;
+    struct wl_resource *res = wl_resource_create(client, &zwp_linux_dmabuf_v1_interface, (int)version, id);
+    if (!res) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+
+    static const struct zwp_linux_dmabuf_v1_interface dmabuf_impl = {
+        .destroy = resource_destroy,
+        .create_params = dmabuf_create_params,
+        .get_default_feedback = dmabuf_feedback_create,
+        .get_surface_feedback = dmabuf_get_surface_feedback
+    };
+    wl_resource_set_implementation(res, &dmabuf_impl, NULL, NULL);
+
+    if (version >= ZWP_LINUX_DMABUF_V1_GET_DEFAULT_FEEDBACK_SINCE_VERSION) return;
+    for (size_t i = 0; i < pixel_format_count(); ++i) {
+        uint32_t format = pixel_format_at(i)->drm_format;
+        if (version >= ZWP_LINUX_DMABUF_V1_MODIFIER_SINCE_VERSION)
+            zwp_linux_dmabuf_v1_send_modifier(res, format, DRM_FORMAT_MOD_LINEAR >> 32,
+                                              DRM_FORMAT_MOD_LINEAR & 0xffffffff);
+        else
+            zwp_linux_dmabuf_v1_send_format(res, format);
+    }
+}
+
+/* --- wp_presentation --- */
+
+/* wp_presentation.feedback: follows the surface's next commit and reports
+ * when (and whether) its content reached the screen */
+static void presentation_feedback(struct wl_client *client, struct wl_resource *res,
+                                  struct wl_resource *surface_res, uint32_t id) {
+    struct surface *surf = wl_resource_get_user_data(surface_res);
+    struct wl_resource *fb = wl_resource_create(client, &wp_presentation_feedback_interface,
+                                                wl_resource_get_version(res), id);
+    if (!fb) {
+        wl_resource_post_no_memory(res);
+        return;
+    }
+    wl_resource_set_implementation(fb, NULL, NULL, frame_callback_destroy_cb);
+    wl_list_insert(surf->pending_feedback.prev, wl_resource_get_link(fb));
+}
+
+static void presentation_bind(struct wl_client *client, void *data, uint32_t version, uint32_t id) {
+    (void)data;
+    struct wl_resource *res = wl_resource_create(client, &wp_presentation_interface, (int)version, id);
+    if (!res) return;
+
+    static const struct wp_presentation_interface presentation_impl = {
+        .destroy = resource_destroy,
+        .feedback = presentation_feedback
+    };
+    wl_resource_set_implementation(res, &presentation_impl, NULL, NULL);
+
+    /* flip timestamps are CLOCK_MONOTONIC (see backend.h) */
+    wp_presentation_send_clock_id(res, CLOCK_MONOTONIC);
+}
+
+/* --- wl_seat implementation --- */
+
+/* Swap-remove res from a resource array */
+static void resource_array_remove(struct wl_resource **arr, int *count, struct wl_resource *res) {
+    for (int i = 0; i < *count; ++i) {
+        if (arr[i] == res) {
+            arr[i] = arr[--*count];
+            arr[*count] = NULL;
+            return;
+        }
+    }
+}
+
+static void pointer_resource_destroy(struct wl_resource *res) {
+    resource_array_remove(pointer_resources, &pointer_count, res);
+}
+
+static void keyboard_resource_destroy(struct wl_resource *res) {
+    resource_array_remove(keyboard_resources, &keyboard_count, res);
+}
+
+static void pointer_send_frame(struct wl_resource *pr) {
+    if (wl_resource_get_version(pr) >= WL_POINTER_FRAME_SINCE_VERSION)
+        wl_pointer_send_frame(pr);
+}
+
+/* Surface under the pointer and the pointer position relative to it */
+static struct surface *surface_at_pointer(wl_fixed_t *sx, wl_fixed_t *sy) {
+    struct scene_view *v = scene_view_at(&scene, (int32_t)seat_cx, (int32_t)seat_cy);
+    if (!v) return NULL;
+    struct surface *surf = wl_container_of(v, surf, view);
+    *sx = wl_fixed_from_double(seat_cx - v->x);
+    *sy = wl_fixed_from_double(seat_cy - v->y);
+    return surf;
+}
+
+/* Move pointer focus to the topmost surface under the pointer, sending
+ * leave/enter to the pointers of the clients involved */
+static void seat_update_focus(void) {
+    wl_fixed_t sx = 0, sy = 0;
+    struct surface *under = surface_at_pointer(&sx, &sy);
+    struct wl_resource *focus = under ? under->resource : NULL;
+    if (pointer_focus == focus) return;
+
+    if (pointer_focus) {
+        struct wl_client *old = wl_resource_get_client(pointer_focus);
+        uint32_t serial = wl_display_next_serial(display);
+        for (int i = 0; i < pointer_count; ++i) {
+            struct wl_resource *pr = pointer_resources[i];
+            if (wl_resource_get_client(pr) != old) continue;
+            wl_pointer_send_leave(pr, serial, pointer_focus);
+            pointer_send_frame(pr);
+        }
+        /* the old client's cursor image no longer applies */
+        if (cursor_surface_res && wl_resource_get_client(cursor_surface_res) == old) {
+            cursor_surface_res = NULL;
+            backend->cursor_set_image(NULL, 0, 0, 0, 0, 0);
+        }
+    }
+
+    pointer_focus = focus;
+    if (!pointer_focus) return;
+
+    struct wl_client *client = wl_resource_get_client(pointer_focus);
+    pointer_enter_serial = wl_display_next_serial(display);
+    for (int i = 0; i < pointer_count; ++i) {
+        struct wl_resource *pr = pointer_resources[i];
+        if (wl_resource_get_client(pr) != client) continue;
+        wl_pointer_send_enter(pr, pointer_enter_serial, pointer_focus, sx, sy);
+        pointer_send_frame(pr);
+    }
+}
+
+/* wl_pointer.set_cursor: give surface the cursor role and show it on the
+ * cursor plane. Only honoured for the focused client's latest enter. */
+static void pointer_set_cursor(struct wl_client *client, struct wl_resource *res, uint32_t serial,
+                               struct wl_resource *surface_res, int32_t hot_x, int32_t hot_y) {
+    if (!pointer_focus || wl_resource_get_client(pointer_focus) != client) return;
+    if (serial != pointer_enter_serial) return;
+
+    if (!surface_res) {
+        cursor_surface_res = NULL;
+        backend->cursor_set_image(NULL, 0, 0, 0, 0, 0);
+        return;
+    }
+
+    struct surface *surf = wl_resource_get_user_data(surface_res);
+    if (surf->role != SURFACE_ROLE_CURSOR && surf->view.mapped) {
+        wl_resource_post_error(res, WL_POINTER_ERROR_ROLE, "surface already has a role");
+        return;
+    }
+    surf->role = SURFACE_ROLE_CURSOR;
+    surf->hot_x = hot_x;
+    surf->hot_y = hot_y;
+    cursor_surface_res = surface_res;
+
+    /* show what was committed before the role was assigned, if still held */
+    if (surf->buffer) cursor_surface_update(surf);
+    else backend->cursor_set_image(NULL, 0, 0, 0, 0, 0);
 }
 
 static const struct wl_pointer_interface pointer_impl = {
-    .set_cursor = NULL,
-    .release = pointer_release
+    .set_cursor = pointer_set_cursor,
+    .release = resource_destroy
 };
 
 static const struct wl_keyboard_interface keyboard_impl = {
-    .release = keyboard_release
+    .release = resource_destroy
+};
+
+static const struct wl_touch_interface touch_impl = {
+    .release = resource_destroy
 };
 
 /* send pointer/key events helpers */
 void wl_seat_send_pointer_motion(double dx, double dy) {
-    if (seat_cx < 0.0 || seat_cy < 0.0) {
-        seat_cx = (double)FALLBACK_W / 2.0;
-        seat_cy = (double)FALLBACK_H / 2.0;
-    }
+    if (scene.width <= 0 || scene.height <= 0) return;
 
     seat_cx += dx;
     seat_cy += dy;
 
+    /* keep the pointer on the layout, and on an output where they differ
+     * in height */
     if (seat_cx < 0.0) seat_cx = 0.0;
     if (seat_cy < 0.0) seat_cy = 0.0;
-    if (seat_cx > FALLBACK_W - 1) seat_cx = FALLBACK_W - 1;
-    if (seat_cy > FALLBACK_H - 1) seat_cy = FALLBACK_H - 1;
+    if (seat_cx > scene.width - 1) seat_cx = scene.width - 1;
+    if (seat_cy > scene.height - 1) seat_cy = scene.height - 1;
+    struct output *o;
+    wl_list_for_each(o, &outputs, link) {
+        if (o->removed || seat_cx < o->x || seat_cx >= o->x + (double)o->width) continue;
+        if (seat_cy > o->y + (double)o->height - 1) seat_cy = o->y + (double)o->height - 1;
+        break;
+    }
+
+    /* the cursor planes move on their own; no output repaint. Each output
+     * gets the position in its own pixels, and hides the cursor if that
+     * is off it. */
+    wl_list_for_each(o, &outputs, link) {
+        if (!o->removed) backend->cursor_move(o->id, (int32_t)seat_cx - o->x, (int32_t)seat_cy - o->y);
+    }
 
-    uint32_t time_ms = (uint32_t)(clock() * 1000 / CLOCKS_PER_SEC);
+    seat_update_focus();
+    if (!pointer_focus) return;
+    struct surface *surf = wl_resource_get_user_data(pointer_focus);
+    struct wl_client *client = wl_resource_get_client(pointer_focus);
+    uint32_t time_ms = monotonic_time_ms();
 
     for (int i = 0; i < pointer_count; ++i) {
         struct wl_resource *pr = pointer_resources[i];
-        if (!pr) continue;
+        if (wl_resource_get_client(pr) != client) continue;
         wl_pointer_send_motion(pr, time_ms,
-                               wl_fixed_from_double(seat_cx),
-                               wl_fixed_from_double(seat_cy));
-        wl_pointer_send_frame(pr);
+                               wl_fixed_from_double(seat_cx - surf->view.x),
+                               wl_fixed_from_double(seat_cy - surf->view.y));
+        pointer_send_frame(pr);
     }
 }
 
 void wl_seat_send_pointer_button(uint32_t time_ms, uint32_t button, uint32_t state) {
-    uint32_t serial = wl_display_get_serial(display);
+    if (!pointer_focus) return;
+
+    /* click to raise */
+    if (state == WL_POINTER_BUTTON_STATE_PRESSED) {
+        struct surface *surf = wl_resource_get_user_data(pointer_focus);
+        if (surf->view.mapped && surf->view.link.next != &scene.views) {
+            scene_view_raise(&scene, &surf->view);
+            flush_scene_damage(NULL);
+        }
+    }
+
+    struct wl_client *client = wl_resource_get_client(pointer_focus);
+    uint32_t serial = wl_display_next_serial(display);
     for (int i = 0; i < pointer_count; ++i) {
         struct wl_resource *pr = pointer_resources[i];
-        if (!pr) continue;
+        if (wl_resource_get_client(pr) != client) continue;
         wl_pointer_send_button(pr, serial, time_ms, button, state);
-        wl_pointer_send_frame(pr);
+        pointer_send_frame(pr);
     }
 }
 
 void wl_seat_send_keyboard_key(uint32_t time_ms, uint32_t key, uint32_t state) {
-    uint32_t serial = wl_display_get_serial(display);
+    uint32_t serial = wl_display_next_serial(display);
     for (int i = 0; i < keyboard_count; ++i) {
         struct wl_resource *kr = keyboard_resources[i];
-        if (!kr) continue;
         wl_keyboard_send_key(kr, serial, time_ms, key, state);
     }
 }
 
-/* wl_seat.get_pointer/get_keyboard handled by creating resources on bind */
-static void seat_bind(struct wl_client *client, void *data, uint32_t version, uint32_t id) {
-    (void)data; (void)version;
-    struct wl_resource *res = wl_resource_create(client, &wl_seat_interface, 1, id);
-    if (!res) return;
+static void seat_get_pointer(struct wl_client *client, struct wl_resource *seat_res, uint32_t id) {
+    struct wl_resource *pr = wl_resource_create(client, &wl_pointer_interface,
+                                                wl_resource_get_version(seat_res), id);
+    if (!pr) {
+        wl_resource_post_no_memory(seat_res);
+        return;
+    }
+    if (pointer_count == MAX_POINTERS) {
+        /* valid object, but it will not receive events */
+        wl_resource_set_implementation(pr, &pointer_impl, NULL, NULL);
+        return;
+    }
+    wl_resource_set_implementation(pr, &pointer_impl, NULL, pointer_resource_destroy);
+    pointer_resources[pointer_count++] = pr;
+
+    if (pointer_focus && wl_resource_get_client(pointer_focus) == client) {
+        struct surface *surf = wl_resource_get_user_data(pointer_focus);
+        wl_pointer_send_enter(pr, pointer_enter_serial, pointer_focus,
+                              wl_fixed_from_double(seat_cx - surf->view.x),
+                              wl_fixed_from_double(seat_cy - surf->view.y));
+        pointer_send_frame(pr);
+    }
+}
 
-    /* create pointer resource for this client */
-    if (pointer_count < MAX_POINTERS) {
-        struct wl_resource *pr = wl_resource_create(client, &wl_pointer_interface, 1, wl_display_get_serial(display));
-        if (pr) {
-            wl_resource_set_implementation(pr, &pointer_impl, NULL, NULL);
-            pointer_resources[pointer_count++] = pr;
-        }
+static void seat_get_keyboard(struct wl_client *client, struct wl_resource *seat_res, uint32_t id) {
+    struct wl_resource *kr = wl_resource_create(client, &wl_keyboard_interface,
+                                                wl_resource_get_version(seat_res), id);
+    if (!kr) {
+        wl_resource_post_no_memory(seat_res);
+        return;
+    }
+    if (keyboard_count == MAX_KEYBOARDS) {
+        wl_resource_set_implementation(kr, &keyboard_impl, NULL, NULL);
+        return;
     }
+    wl_resource_set_implementation(kr, &keyboard_impl, NULL, keyboard_resource_destroy);
+    keyboard_resources[keyboard_count++] = kr;
+}
 
-    /* create keyboard resource for this client */
-    if (keyboard_count < MAX_KEYBOARDS) {
-        struct wl_resource *kr = wl_resource_create(client, &wl_keyboard_interface, 1, wl_display_get_serial(display));
-        if (kr) {
-            wl_resource_set_implementation(kr, &keyboard_impl, NULL, NULL);
-            keyboard_resources[keyboard_count++] = kr;
-        }
+/* No touch capability is advertised; the object is inert */
+static void seat_get_touch(struct wl_client *client, struct wl_resource *seat_res, uint32_t id) {
+    struct wl_resource *tr = wl_resource_create(client, &wl_touch_interface,
+                                                wl_resource_get_version(seat_res), id);
+    if (!tr) {
+        wl_resource_post_no_memory(seat_res);
+        return;
     }
+    wl_resource_set_implementation(tr, &touch_impl, NULL, NULL);
+}
+
+static void seat_bind(struct wl_client *client, void *data, uint32_t version, uint32_t id) {
+    (void)data;
+    struct wl_resource *res = wl_resource_create(client, &wl_seat_interface, (int)version, id);
+    if (!res) return;
 
-    /* advertise seat name */
-    wl_seat_send_name(res, "seat0");
+    static const struct wl_seat_interface seat_impl = {
+        .get_pointer = seat_get_pointer,
+        .get_keyboard = seat_get_keyboard,
+        .get_touch = seat_get_touch,
+        .release = resource_destroy
+    };
+
+    wl_resource_set_implementation(res, &seat_impl, NULL, NULL);
+    wl_seat_send_capabilities(res, WL_SEAT_CAPABILITY_POINTER | WL_SEAT_CAPABILITY_KEYBOARD);
+    if (version >= WL_SEAT_NAME_SINCE_VERSION)
+        wl_seat_send_name(res, "seat0");
 }
 
 /* initialize/free seat */
 int wl_seat_init(void) {
     if (!display) return -1;
-    wl_global_create(display, &wl_seat_interface, 1, NULL, seat_bind);
+    wl_global_create(display, &wl_seat_interface, SEAT_VERSION, NULL, seat_bind);
     return 0;
 }
 
 void wl_seat_fini(void) {
-    /* clear resources lists; actual wl_resource cleanup is handled by Wayland on client disconnect */
-    for (int i = 0; i < pointer_count; ++i) pointer_resources[i] = NULL;
+    /* resources themselves go away with their clients */
+    for (int i = 0; i < pointer_count; ++i) wl_resource_set_destructor(pointer_resources[i], NULL);
+    for (int i = 0; i < keyboard_count; ++i) wl_resource_set_destructor(keyboard_resources[i], NULL);
+    memset(pointer_resources, 0, sizeof(pointer_resources));
     pointer_count = 0;
-    for (int i = 0; i < keyboard_count; ++i) keyboard_resources[i] = NULL;
+    memset(keyboard_resources, 0, sizeof(keyboard_resources));
     keyboard_count = 0;
 }
 
@@ -439,11 +2159,35 @@ int wl_init_server(void) {
         return -1;
     }
 
+    wl_list_init(&surfaces);
+    wl_list_init(&outputs);
+    memset(&removed_stats, 0, sizeof(removed_stats));
+    const char *env = getenv("ARGUS_SCANOUT");
+    scanout_enabled = !(env && strcmp(env, "0") == 0);
+    slab_init(&buffer_slab, sizeof(struct shm_buffer), BUFFER_SLAB_CHUNK);
+
+    /* sized as outputs are announced by the render thread */
+    scene_init(&scene, 0, 0, BACKGROUND_COLOR);
+
     /* create required globals */
-    wl_global_create(display, &wl_compositor_interface, 1, NULL, compositor_bind);
+    wl_global_create(display, &wl_compositor_interface, COMPOSITOR_VERSION, NULL, compositor_bind);
     wl_global_create(display, &wl_shm_interface, 1, NULL, shm_bind);
+    wl_global_create(display, &wp_presentation_interface, PRESENTATION_VERSION, NULL, presentation_bind);
+    /* without a format table there is no feedback, so stop short of v4 */
+    wl_global_create(display, &zwp_linux_dmabuf_v1_interface, dmabuf_table_init() == 0 ? DMABUF_VERSION : 3, NULL,
+                     dmabuf_bind);
     /* seat will be created by input_init calling wl_seat_init */
 
+    cursor_frame_timer = wl_event_loop_add_timer(evloop, cursor_frame_timer_cb, NULL);
+
+    /* composition, pageflips and hotplug run on the render thread from
+     * here on; the outputs arrive as its first events */
+    if (render_start(evloop, render_event_cb, NULL) != 0) {
+        fprintf(stderr, "Argus: failed to start the render thread\n");
+        wl_fini_server();
+        return -1;
+    }
+
     wl_display_flush_clients(display);
     printf("Wayland display socket: %s\n", socket_name);
     return 0;
@@ -463,7 +2207,29 @@ int wl_run_iteration(int timeout_ms) {
 
 void wl_fini_server(void) {
     if (!display) return;
+    /* frames the render thread never finished come back here first */
+    render_stop();
+    render_frame_destroy(next_frame);
+    next_frame = NULL;
+    struct output *o, *tmp;
+    wl_list_for_each_safe(o, tmp, &outputs, link) {
+        destroy_frame_batches(o);
+        output_destroy(o);
+    }
+    if (cursor_frame_timer) {
+        wl_event_source_remove(cursor_frame_timer);
+        cursor_frame_timer = NULL;
+        cursor_frame_armed = 0;
+    }
+    /* client resources reference buffer_slab, so drop them first */
+    wl_display_destroy_clients(display);
     wl_display_destroy(display);
+    slab_fini(&buffer_slab);
+    if (dmabuf_table_fd >= 0) close(dmabuf_table_fd);
+    dmabuf_table_fd = -1;
+    if (udmabuf_dev >= 0) close(udmabuf_dev);
+    udmabuf_dev = -1;
+    scene_fini(&scene);
     display = NULL;
     evloop = NULL;
     socket_name = NULL;
@@ -472,3 +2238,31 @@ void wl_fini_server(void) {
 struct wl_display *wl_get_display(void) {
     return display;
 }
+
+struct wl_event_loop *wl_get_event_loop(void) {
+    return evloop;
+}
+
+size_t wl_client_live_buffers(struct wl_client *client) {
+    struct client_state *cs = client_state_find(client);
+    return cs ? cs->live_buffers : 0;
+}
+
+size_t wl_live_buffers(void) {
+    return buffer_slab.live;
+}
+
+/* Summed over all outputs, past and present; the budget is the largest */
+void wl_get_repaint_stats(struct repaint_stats *out) {
+    *out = removed_stats;
+    if (!display) return;
+    const struct output *o;
+    wl_list_for_each(o, &outputs, link) {
+        out->frames += o->sched.stats.frames;
+        out->missed += o->sched.stats.missed;
+        out->late += o->sched.stats.late;
+        out->bypassed += o->sched.stats.bypassed;
+        out->overlaid += o->sched.stats.overlaid;
+        if (o->sched.stats.budget_ns > out->budget_ns) out->budget_ns = o->sched.stats.budget_ns;
+    }
+}
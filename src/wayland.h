@@ -3,10 +3,22 @@
 
 #include <wayland-server-core.h>
 
+#include "repaint.h"
+
 int wl_init_server(void);
 int wl_run_iteration(int timeout_ms);
 void wl_fini_server(void);
 struct wl_display *wl_get_display(void);
+struct wl_event_loop *wl_get_event_loop(void);
+
+/* Live wl_buffer records, for one client or in total */
+size_t wl_client_live_buffers(struct wl_client *client);
+size_t wl_live_buffers(void);
+
+/* Repaint scheduler counters, including missed vblank deadlines, frames
+ * scanned out directly and buffers shown on overlay planes
+ * (ARGUS_SCANOUT=0 composites everything) */
+void wl_get_repaint_stats(struct repaint_stats *out);
 
 /* Seat / input helpers (used by input.c) */
 int wl_seat_init(void);
@@ -0,0 +1,126 @@
+#include "workers.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define MAX_WORKERS 32
+
+static struct {
+    pthread_t threads[MAX_WORKERS];
+    int nthreads;
+
+    pthread_mutex_t lock;
+    pthread_cond_t start; /* a new job was posted, or quit */
+    pthread_cond_t done; /* the last worker left the job */
+    uint64_t generation; /* bumped per job */
+    int active; /* workers still inside the current job */
+    int quit;
+
+    /* current job */
+    worker_fn fn;
+    void *ctx;
+    unsigned count;
+    atomic_uint next;
+} P = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .start = PTHREAD_COND_INITIALIZER,
+    .done = PTHREAD_COND_INITIALIZER,
+};
+
+static void run_items(void) {
+    unsigned i;
+    while ((i = atomic_fetch_add_explicit(&P.next, 1, memory_order_relaxed)) < P.count)
+        P.fn(P.ctx, i);
+}
+
+static void *worker_main(void *arg) {
+    (void)arg;
+    uint64_t seen = 0;
+
+    pthread_mutex_lock(&P.lock);
+    for (;;) {
+        while (!P.quit && P.generation == seen) pthread_cond_wait(&P.start, &P.lock);
+        if (P.quit) break;
+        seen = P.generation;
+        pthread_mutex_unlock(&P.lock);
+
+        run_items();
+
+        pthread_mutex_lock(&P.lock);
+        if (--P.active == 0) pthread_cond_signal(&P.done);
+    }
+    pthread_mutex_unlock(&P.lock);
+    return NULL;
+}
+
+int workers_init(int nthreads) {
+    const char *env = getenv("ARGUS_WORKERS");
+    if (env) {
+        nthreads = atoi(env);
+    } else if (nthreads <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = cpus > 1 ? (int)cpus - 1 : 0;
+    }
+    if (nthreads < 0) nthreads = 0;
+    if (nthreads > MAX_WORKERS) nthreads = MAX_WORKERS;
+
+    P.quit = 0;
+    P.nthreads = 0;
+    /* workers inherit a mask blocking every signal, so SIGINT and SIGTERM
+     * always reach the main thread's event loop */
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    for (int i = 0; i < nthreads; ++i) {
+        if (pthread_create(&P.threads[i], NULL, worker_main, NULL) != 0) {
+            perror("pthread_create");
+            break;
+        }
+        P.nthreads++;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    printf("workers: %d composition threads\n", P.nthreads);
+    return 0;
+}
+
+void workers_fini(void) {
+    pthread_mutex_lock(&P.lock);
+    P.quit = 1;
+    pthread_cond_broadcast(&P.start);
+    pthread_mutex_unlock(&P.lock);
+    for (int i = 0; i < P.nthreads; ++i) pthread_join(P.threads[i], NULL);
+    P.nthreads = 0;
+}
+
+int workers_count(void) {
+    return P.nthreads;
+}
+
+void workers_run(worker_fn fn, void *ctx, unsigned count) {
+    if (P.nthreads == 0 || count <= 1) {
+        for (unsigned i = 0; i < count; ++i) fn(ctx, i);
+        return;
+    }
+
+    pthread_mutex_lock(&P.lock);
+    P.fn = fn;
+    P.ctx = ctx;
+    P.count = count;
+    atomic_store_explicit(&P.next, 0, memory_order_relaxed);
+    P.active = P.nthreads;
+    P.generation++;
+    pthread_cond_broadcast(&P.start);
+    pthread_mutex_unlock(&P.lock);
+
+    run_items();
+
+    /* barrier: every worker has finished its last item */
+    pthread_mutex_lock(&P.lock);
+    while (P.active > 0) pthread_cond_wait(&P.done, &P.lock);
+    pthread_mutex_unlock(&P.lock);
+}
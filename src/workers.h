@@ -0,0 +1,21 @@
+#ifndef ARGUS_WORKERS_H
+#define ARGUS_WORKERS_H
+
+/* Fixed pool of worker threads for data-parallel jobs. A job is a function
+ * applied to items 0..count-1; workers and the calling thread pull item
+ * numbers from a shared atomic counter until none are left, and
+ * workers_run() returns only once every item is done.
+ *
+ * workers_init(0) sizes the pool to the online CPUs minus one (the caller
+ * works too); ARGUS_WORKERS overrides that, and 0 runs every job inline.
+ * Only one thread may submit jobs.
+ */
+typedef void (*worker_fn)(void *ctx, unsigned index);
+
+int workers_init(int nthreads);
+void workers_fini(void);
+int workers_count(void);
+
+void workers_run(worker_fn fn, void *ctx, unsigned count);
+
+#endif